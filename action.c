@@ -58,6 +58,7 @@ struct action_lookup  ac_lookup_table[] = {
 	{ "ungrabkeys",     a_ungrabkeys},
 	{ "grabmouse",       a_grabmouse},
 	{ "ungrabmouse",     a_ungrabmouse},
+	{ "printstats",     a_printstats},
 	{ 0, 0 }
 };
 
@@ -285,15 +286,11 @@ a_collapse(char * opt[]){
 
 int
 a_uncollapse(char * opt[]){
-	int i;
 	(void)opt;
 	if(!dzen.slave_win.ishmenu
 			&& dzen.slave_win.max_lines
-			&& !dzen.slave_win.issticky) {
+			&& !dzen.slave_win.issticky)
 		XMapRaised(dzen.dpy, dzen.slave_win.win);
-		for(i=0; i < dzen.slave_win.max_lines; i++)
-			XMapWindow(dzen.dpy, dzen.slave_win.line[i]);
-	}
 	return 0;
 }
 
@@ -443,6 +440,15 @@ a_print(char * opt[]) {
 	return 0;
 }
 
+int
+a_printstats(char * opt[]) {
+	printf("coalesced %lu skipped %lu icon-hits %lu icon-misses %lu\n",
+			dzen.title_win.ncoalesced, dzen.title_win.nskipped,
+			dzen.icon_hits, dzen.icon_misses);
+	fflush(stdout);
+	return 0;
+}
+
 int
 a_menuprint(char * opt[]) {
 	char *text;
@@ -465,11 +471,13 @@ a_menuprint(char * opt[]) {
 
 int
 a_menuprint_noparse(char * opt[]) {
+	char *text = NULL;
 	int i;
 
 	if(dzen.slave_win.ismenu && dzen.slave_win.sel_line != -1
 			&& (dzen.slave_win.sel_line + dzen.slave_win.first_line_vis) < dzen.slave_win.tcnt) {
-		printf("%s", dzen.slave_win.tbuf[dzen.slave_win.sel_line]);
+		buf_line(dzen.slave_win.sel_line + dzen.slave_win.first_line_vis, &text);
+		printf("%s", text ? text : "");
 		if(opt)
 			for(i=0; opt[i]; ++i)
 				printf("%s", opt[i]);
@@ -83,4 +83,5 @@ int a_grabkeys(char **);
 int a_ungrabkeys(char **);
 int a_grabmouse(char **);
 int a_ungrabmouse(char **);
+int a_printstats(char **);
 
@@ -0,0 +1,101 @@
+/*
+ * (C)opyright 2007-2009 Robert Manea <rob dot manea at gmail dot com>
+ * See LICENSE file for license details.
+ *
+ */
+
+#include "dzen.h"
+
+#include <stdlib.h>
+
+/*
+ * Memory for the lines of the slave window buffer.
+ *
+ * Lines are appended to the newest of a list of chunks and leave the
+ * buffer oldest first, see evict_line(). A chunk only counts its live
+ * lines and goes away as a whole once the last of them is dropped, so
+ * adding and dropping a line costs no malloc() or free() of its own.
+ * One emptied chunk is kept for reuse.
+ */
+
+#define CHUNK_SIZE	(64*1024)
+#define ALIGN(n)	(((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+typedef struct _Chunk Chunk;
+struct _Chunk {
+	Chunk *next;
+	size_t used, size;
+	int lines;				/* lines not yet dropped */
+	void *data[];
+};
+
+static Chunk *head = NULL, *tail = NULL, *spare = NULL;
+
+static void
+chunk_free(Chunk *c) {
+	if(!spare && c->size == CHUNK_SIZE) {
+		spare = c;
+		return;
+	}
+	free(c);
+}
+
+/* returns memory for a new line, it lives until the line is dropped */
+void *
+arena_alloc(size_t n) {
+	Chunk *c;
+	void *p;
+
+	n = ALIGN(n);
+	if(!tail || tail->used + n > tail->size) {
+		if(spare && n <= CHUNK_SIZE) {
+			c = spare;
+			spare = NULL;
+		}
+		else {
+			/* an overlong line gets a chunk of its own */
+			c = emalloc(sizeof(Chunk) + (n > CHUNK_SIZE ? n : CHUNK_SIZE));
+			c->size = n > CHUNK_SIZE ? n : CHUNK_SIZE;
+		}
+		c->next = NULL;
+		c->used = 0;
+		c->lines = 0;
+		if(tail)
+			tail->next = c;
+		else
+			head = c;
+		tail = c;
+	}
+
+	p = (char *)tail->data + tail->used;
+	tail->used += n;
+	tail->lines++;
+	return p;
+}
+
+/* the oldest line is gone */
+void
+arena_drop(void) {
+	Chunk *c = head;
+
+	if(!c || --c->lines)
+		return;
+	if(c == tail) {
+		c->used = 0;
+		return;
+	}
+	head = c->next;
+	chunk_free(c);
+}
+
+/* all lines are gone */
+void
+arena_clear(void) {
+	Chunk *c;
+
+	while((c = head)) {
+		head = c->next;
+		chunk_free(c);
+	}
+	tail = NULL;
+}
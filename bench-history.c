@@ -0,0 +1,120 @@
+/*
+ * bench-history - slave window buffer benchmark for dzen
+ *
+ * Usage: ./bench-history [-n count] [-history lines]
+ *
+ * Adds count log lines to a slave window buffer of the given number of
+ * lines (default: 1024), dropping the oldest line once it is full, the
+ * way drawbody() does, and compiling every line. This is done once with
+ * a malloc() for the text and one for the display list of every line,
+ * as dzen did before the line arena, and once through the line arena.
+ * Each run is a child process of its own and prints the lines per
+ * second and its maximum resident set size. No X server is needed.
+ *
+ * Build with 'make bench-history'.
+ */
+
+#include "dzen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+Dzen dzen;
+click_a sens_areas[MAX_CLICKABLE_AREAS];
+int sens_areas_cnt;
+
+void free_buffer(void) {}
+void evict_line(void) {}
+Dlist *buf_line(int l, char **text) { return NULL; }
+void x_draw_body(void) {}
+
+static const char *sample[] = {
+	"Oct 17 12:34:56 host sshd[1234]: Accepted publickey for user from 10.0.0.1 port 52814 ssh2",
+	"Oct 17 12:34:57 host kernel: [12345.678901] wlan0: associated",
+	"Oct 17 12:34:58 ^p(+4)^r(6x6)^p(+4) cron[42]: (root) CMD (run-parts /etc/cron.hourly)",
+	"ok",
+	"Oct 17 12:35:01 host systemd[1]: Started Session 1234 of user user.",
+};
+#define NSAMPLE (sizeof(sample) / sizeof(sample[0]))
+
+static double
+now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+run(int arena, long n, int size) {
+	static Dlist dl;
+	Dlist **tdl;
+	char **tbuf;
+	long i;
+	int k, slot, head = 0, cnt = 0;
+	double t0;
+
+	tbuf = emalloc(size * sizeof(char *));
+	tdl = emalloc(size * sizeof(Dlist *));
+
+	t0 = now();
+	for(i=0; i < n; i++) {
+		if(cnt == size) {
+			if(arena)
+				arena_drop();
+			else {
+				free(tbuf[head]);
+				free(tdl[head]);
+			}
+			head = (head + 1) % size;
+			cnt--;
+		}
+		k = i % NSAMPLE;
+		slot = (head + cnt++) % size;
+		if(arena)
+			tdl[slot] = compile_text(sample[k], arena_alloc, &tbuf[slot]);
+		else {
+			/* as dzen did before the line arena */
+			compile_line(&dl, sample[k]);
+			tbuf[slot] = estrdup(sample[k]);
+			tdl[slot] = dl_copy(emalloc(dl_size(&dl)), &dl);
+		}
+	}
+	printf("%-8s %10.0f lines/s", arena ? "arena:" : "malloc:", n / (now() - t0));
+	fflush(stdout);
+}
+
+int
+main(int argc, char *argv[]) {
+	struct rusage ru;
+	long n = 2000000;
+	int i, arena, size = 1024;
+	pid_t pid;
+
+	for(i=1; i < argc; i++) {
+		if(!strcmp(argv[i], "-n") && i+1 < argc)
+			n = atol(argv[++i]);
+		else if(!strcmp(argv[i], "-history") && i+1 < argc)
+			size = atoi(argv[++i]);
+	}
+	if(size < 1)
+		eprint("bench-history: -history must be at least 1\n");
+
+	printf("%ld lines, %d kept\n", n, size);
+	for(arena=0; arena < 2; arena++) {
+		fflush(stdout);
+		if(!(pid = fork())) {
+			run(arena, n, size);
+			exit(EXIT_SUCCESS);
+		}
+		if(pid == -1 || wait4(pid, &i, 0, &ru) == -1)
+			eprint("bench-history: cannot run the benchmark\n");
+		printf("  max rss %6ld kB\n", ru.ru_maxrss);
+	}
+	return 0;
+}
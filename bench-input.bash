@@ -0,0 +1,29 @@
+#!/bin/bash
+#
+#	bench-input.bash - Input throughput benchmark for dzen
+#
+#	Usage: ./bench-input.bash [dzen2 binary ...]
+#
+#	Pushes N status lines through every given binary (default ./dzen2)
+#	and prints the time it took. Build a previous revision into a second
+#	binary to compare the input path against it, e.g.:
+#
+#	  ./bench-input.bash ./dzen2.old ./dzen2
+#
+
+N=${N:-100000}
+LINE='^fg(#aaaaaa)cpu ^fg(red)42% ^fg()mem 1234M ^fg(#6fbf47)net 12k/3k'
+
+run ()
+{
+	yes "$LINE" | head -n $N | $APP "$@" > /dev/null
+}
+
+for APP in "${@:-./dzen2}"
+do
+	echo "# $APP: $N lines to the slave window (-l 20)"
+	time run -l 20
+	echo "# $APP: $N lines to the title window"
+	time run
+	echo -e "\n"
+done
@@ -0,0 +1,94 @@
+/*
+ * bench-textw - text measurement benchmark for dzen
+ *
+ * Usage: ./bench-textw [-fn font] [-n count] [text]
+ *
+ * Measures the given text (default: a typical status line) count times,
+ * once through the uncached X measurement and once through textnw()
+ * with the glyph advance cache, and prints the time per call and the
+ * widths both paths returned. It then compares both widths for some
+ * strings that would be kerned and exits with 1 if any of them differ.
+ * Needs a running X server.
+ *
+ * Build with 'make bench-textw'.
+ */
+
+#include "dzen.h"
+
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+Dzen dzen;
+click_a sens_areas[MAX_CLICKABLE_AREAS];
+int sens_areas_cnt;
+
+void free_buffer(void) {}
+void evict_line(void) {}
+Dlist *buf_line(int l, char **text) { return NULL; }
+void x_draw_body(void) {}
+
+static double
+now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *kerned[] = {
+	"AV", "To", "Wa", "LT", "Yo", "P.", "AVAVAVAV", "T,", "fi fl ff",
+	"\xc3\x84V \xc3\x96T", "\xce\x91\xce\xa5",
+};
+
+int
+main(int argc, char *argv[]) {
+	const char *font = FONT;
+	const char *text = "cpu 42% mem 1234M net 12k/3k | vol 80% | Fri 17 Oct 12:34";
+	unsigned int w0 = 0, w1 = 0;
+	long i, n = 100000;
+	int bad = 0;
+	double t0, t1, t2;
+
+	for(i=1; i < argc; i++) {
+		if(!strcmp(argv[i], "-fn") && i+1 < argc)
+			font = argv[++i];
+		else if(!strcmp(argv[i], "-n") && i+1 < argc)
+			n = atol(argv[++i]);
+		else
+			text = argv[i];
+	}
+
+	setlocale(LC_ALL, "");
+	if(!(dzen.dpy = XOpenDisplay(NULL)))
+		eprint("bench-textw: cannot open display\n");
+	dzen.screen = DefaultScreen(dzen.dpy);
+	setfont(font);
+
+	t0 = now();
+	for(i=0; i < n; i++)
+		w0 = textnw_uncached(&dzen.font, text, strlen(text));
+	t1 = now();
+	for(i=0; i < n; i++)
+		w1 = textnw(&dzen.font, text, strlen(text));
+	t2 = now();
+
+	printf("%ld x %zu bytes, font '%s'\n", n, strlen(text), font);
+	printf("uncached: %8.3f us/call  width %u\n", (t1 - t0) * 1e6 / n, w0);
+	printf("cached:   %8.3f us/call  width %u\n", (t2 - t1) * 1e6 / n, w1);
+
+	for(i=0; i < (long)(sizeof kerned / sizeof kerned[0]); i++) {
+		w0 = textnw_uncached(&dzen.font, kerned[i], strlen(kerned[i]));
+		w1 = textnw(&dzen.font, kerned[i], strlen(kerned[i]));
+		if(w0 != w1) {
+			printf("differs:  '%s' uncached %u cached %u\n", kerned[i], w0, w1);
+			bad = 1;
+		}
+	}
+
+	free_fonts();
+	XCloseDisplay(dzen.dpy);
+	return bad;
+}
@@ -52,21 +52,28 @@ CFLAGS = -Wall -Os ${INCS} -DVERSION=\"${VERSION}\" -DDZEN_XFT `pkg-config --cfl
 #LIBS = -L/usr/lib -lc -L${X11LIB} -lX11 -lXinerama -lXpm `pkg-config --libs xft`
 #CFLAGS = -Wall -Os ${INCS} -DVERSION=\"${VERSION}\" -DDZEN_XINERAMA -DDZEN_XPM -DDZEN_XFT `pkg-config --cflags xft`
 
+## Optional, in addition to any of the above: MIT-SHM uploads for -raster
+#LIBS += -lXext
+#CFLAGS += -DDZEN_XSHM
+
+## Optional, in addition to any of the above: ARGB icons (.dzi) with alpha
+#LIBS += -lXrender
+#CFLAGS += -DDZEN_XRENDER
 
 
 # END of feature configuration
 
 
-LDFLAGS = ${LIBS}
+LDFLAGS = ${LIBS} -lpthread
 
 # Solaris, uncomment for Solaris
 #CFLAGS = -fast ${INCS} -DVERSION=\"${VERSION}\"
-#LDFLAGS = ${LIBS}
+#LDFLAGS = ${LIBS} -lpthread
 #CFLAGS += -xtarget=ultra
 
 # Debugging
 #CFLAGS = ${INCS} -DVERSION=\"${VERSION}\" -std=gnu89 -pedantic -Wall -W -Wundef -Wendif-labels -Wshadow -Wpointer-arith -Wbad-function-cast -Wcast-align -Wwrite-strings -Wstrict-prototypes -Wmissing-prototypes -Wnested-externs -Winline -Wdisabled-optimization -O2 -pipe -DDZEN_XFT `pkg-config --cflags xft`
-#LDFLAGS = ${LIBS}
+#LDFLAGS = ${LIBS} -lpthread
 
 # compiler and linker
 CC = gcc
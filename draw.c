@@ -8,32 +8,53 @@
 #include "dzen.h"
 #include "action.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifdef DZEN_XPM
-#include <X11/xpm.h>
-#endif
+#include <wchar.h>
 
 #define ARGLEN 256
-#define MAX_ICON_CACHE 32
+#define MAX_COLOR_CACHE 256
+#define MAX_FONT_CACHE 16
+#define ADV_HASH_SIZE 512
+#define ADV_UNKNOWN SHRT_MIN
 
-#define MAX(a,b) ((a)>(b)?(a):(b))
+#define MAX_DAMAGE 16
+#define MAX_BATCHES 4
+#define MAX_BATCH 256
 
-typedef struct ICON_C {
-	char name[ARGLEN];
-	Pixmap p;
+#define UTF8_CONT(c) (((unsigned char)(c) & 0xc0) == 0x80)
+#define MAX(a,b) ((a)>(b)?(a):(b))
+#define MIN(a,b) ((a)<(b)?(a):(b))
 
-	int w, h;
-} icon_c;
+typedef struct COLOR_C {
+	char *name;			/* NULL if the slot is free */
+	unsigned long pixel;
+	Bool alloced;		/* pixel is a colormap cell of the server */
+#ifdef DZEN_XFT
+	XftColor xft;
+	Bool hasxft;
+#endif
+} color_c;
+
+/* direct mapped by the hash of the name, see getcolor() */
+static color_c colors[MAX_COLOR_CACHE];
+
+/* glyph advances of one font, see glyph_advance() */
+struct _Advcache {
+	short lat1[256];
+	struct {
+		unsigned int cp;
+		short adv;
+	} hash[ADV_HASH_SIZE];
+};
 
-icon_c icons[MAX_ICON_CACHE];
-int icon_cnt;
 int otx;
 int xorig=0;
 
 /* command types for the in-text parser */
-enum ctype  {bg, fg, icon, rect, recto, circle, circleo, pos, abspos, titlewin, ibg, fn, fixpos, ca, ba};
+enum ctype  {bg, fg, icon, rect, recto, circle, circleo, pos, abspos, titlewin, ibg, fn, fixpos, ca, ba, region};
 
 struct command_lookup {
 	const char *name;
@@ -56,6 +77,7 @@ struct command_lookup cmd_lookup_table[] = {
 	{ "fn(",        fn,			3},
 	{ "ca(",        ca,			3},
 	{ "ba(",		ba,			3},
+	{ "rg(",		region,		3},
 	{ 0,			0,			0}
 };
 
@@ -66,8 +88,8 @@ enum sctype {LOCK_X, UNLOCK_X, TOP, BOTTOM, CENTER, LEFT, RIGHT};
 int get_tokval(const char* line, char **retdata);
 int get_token(const char*  line, int * t, char **tval);
 
-static unsigned int
-textnw(Fnt *font, const char *text, unsigned int len) {
+unsigned int
+textnw_uncached(Fnt *font, const char *text, unsigned int len) {
 #ifndef DZEN_XFT
 	XRectangle r;
 
@@ -77,91 +99,502 @@ textnw(Fnt *font, const char *text, unsigned int len) {
 	}
 	return XTextWidth(font->xfont, text, len);
 #else
-	XftTextExtentsUtf8(dzen.dpy, dzen.font.xftfont, (unsigned const char *) text, strlen(text), dzen.font.extents);
-	if(dzen.font.extents->height > dzen.font.height)
-		dzen.font.height = dzen.font.extents->height;
-	return dzen.font.extents->xOff;
+	XGlyphInfo extents;
+
+	XftTextExtentsUtf8(dzen.dpy, font->xftfont, (unsigned const char *) text, len, &extents);
+	if(extents.height > font->height)
+		font->height = extents.height;
+	return extents.xOff;
+#endif
+}
+
+
+static Advcache *
+adv_new(void) {
+	Advcache *ac;
+	int i;
+
+	ac = emalloc(sizeof(Advcache));
+	for(i=0; i < 256; i++)
+		ac->lat1[i] = ADV_UNKNOWN;
+	for(i=0; i < ADV_HASH_SIZE; i++)
+		ac->hash[i].cp = 0;
+	return ac;
+}
+
+#ifdef DZEN_XFT
+/* returns the length of the UTF-8 character at s, 0 if it is invalid */
+static int
+utf8_decode(const char *s, int len, unsigned int *cp) {
+	unsigned char c = s[0];
+	int i, n;
+
+	if(c < 0x80) {
+		*cp = c;
+		return 1;
+	}
+	else if((c & 0xe0) == 0xc0) {
+		*cp = c & 0x1f;
+		n = 2;
+	}
+	else if((c & 0xf0) == 0xe0) {
+		*cp = c & 0x0f;
+		n = 3;
+	}
+	else if((c & 0xf8) == 0xf0) {
+		*cp = c & 0x07;
+		n = 4;
+	}
+	else
+		return 0;
+
+	if(n > len)
+		return 0;
+	for(i=1; i < n; i++) {
+		if(!UTF8_CONT(s[i]))
+			return 0;
+		*cp = *cp << 6 | (s[i] & 0x3f);
+	}
+	return n;
+}
+#endif
+
+/*
+ * Returns the advance of the character at text, which is at most len
+ * bytes long, and sets *clen to the length of its encoding. Advances
+ * are cached per font in a dense table for Latin-1 and a direct mapped
+ * hash for everything else, so only the first use of a character costs
+ * a measurement. Returns ADV_UNKNOWN if text does not decode.
+ *
+ * Summing the advances gives the width textnw_uncached() measures: Xft
+ * does not kern, XftTextExtentsUtf8() adds up the xOff of each glyph,
+ * and XTextWidth() and XmbTextExtents() add up per character widths
+ * as well. bench-textw checks this for a font.
+ */
+static int
+glyph_advance(Fnt *font, const char *text, int len, int *clen) {
+	Advcache *ac = font->adv;
+	unsigned int cp;
+	short *slot;
+	int adv, h;
+#ifdef DZEN_XFT
+	XGlyphInfo extents;
+
+	if(!(*clen = utf8_decode(text, len, &cp)))
+		return ADV_UNKNOWN;
+#else
+	XRectangle r;
+	mbstate_t ps;
+	wchar_t wc;
+	size_t n;
+
+	if(font->set) {
+		memset(&ps, 0, sizeof ps);
+		n = mbrtowc(&wc, text, len, &ps);
+		if(n == 0 || n == (size_t)-1 || n == (size_t)-2)
+			return ADV_UNKNOWN;
+		*clen = n;
+		cp = wc;
+	}
+	else {
+		*clen = 1;
+		cp = (unsigned char)text[0];
+	}
+#endif
+
+	if(!ac)
+		return ADV_UNKNOWN;
+	if(cp < 256)
+		slot = &ac->lat1[cp];
+	else {
+		h = cp % ADV_HASH_SIZE;
+		if(ac->hash[h].cp != cp) {
+			ac->hash[h].cp = cp;
+			ac->hash[h].adv = ADV_UNKNOWN;
+		}
+		slot = &ac->hash[h].adv;
+	}
+	if(*slot != ADV_UNKNOWN)
+		return *slot;
+
+#ifdef DZEN_XFT
+	XftTextExtentsUtf8(dzen.dpy, font->xftfont, (unsigned const char *) text, *clen, &extents);
+	if(extents.height > font->height)
+		font->height = extents.height;
+	adv = extents.xOff;
+#else
+	if(font->set) {
+		XmbTextExtents(font->set, text, *clen, NULL, &r);
+		adv = r.width;
+	}
+	else
+		adv = XTextWidth(font->xfont, text, 1);
+#endif
+	if(adv != ADV_UNKNOWN && adv == (short)adv)
+		*slot = adv;
+	return adv;
+}
+
+unsigned int
+textnw(Fnt *font, const char *text, unsigned int len) {
+	unsigned int i, w = 0;
+	int adv, clen;
+
+	for(i=0; i < len; i += clen) {
+		if((adv = glyph_advance(font, text + i, len - i, &clen)) == ADV_UNKNOWN)
+			return textnw_uncached(font, text, len);
+		w += adv;
+	}
+	return w;
+}
+
+/*
+ * Returns the length of the longest prefix of text, len bytes long and
+ * wider than w, that fits into w pixels and sets *tw to its width. The
+ * cached glyph advances are summed up to the cut, text that does not
+ * decode is cut by binary search with O(log len) measurements.
+ * Multibyte strings are only cut at character boundaries.
+ */
+static int
+textfit(Fnt *font, const char *text, int len, int w, int *tw) {
+	int lo = 0, hi = len, mid, mw, adv, clen;
+#ifdef DZEN_XFT
+	int mb = 1;
+#else
+	int mb = font->set != NULL;
 #endif
+
+	for(*tw = 0; lo < len; lo += clen) {
+		if((adv = glyph_advance(font, text + lo, len - lo, &clen)) == ADV_UNKNOWN)
+			break;
+		if(*tw + adv > w)
+			return lo;
+		*tw += adv;
+	}
+	if(lo == len)
+		return lo;
+
+	lo = 0;
+	*tw = 0;
+	/* text[0..lo) fits, text[0..hi) does not */
+	while(hi - lo > 1) {
+		mid = lo + (hi - lo)/2;
+		while(mb && mid > lo && UTF8_CONT(text[mid]))
+			mid--;
+		if(mid == lo) {
+			mid = lo + (hi - lo)/2 + 1;
+			while(mb && mid < hi && UTF8_CONT(text[mid]))
+				mid++;
+			if(mid == hi)
+				break;
+		}
+		if((mw = textnw(font, text, mid)) <= w) {
+			lo = mid;
+			*tw = mw;
+		}
+		else
+			hi = mid;
+	}
+
+	return lo;
 }
 
+/*
+ * All slave lines are kept in one pixmap, dzen.slave_win.pm, in the
+ * place they have in the slave window: one below the other or side by
+ * side with -m h, where the last line takes the rest of the width.
+ */
+void
+slot_rect(int line, XRectangle *r) {
+	SWIN *s = &dzen.slave_win;
+
+	r->height = dzen.line_height;
+	if(s->ishmenu) {
+		r->x = line * s->lw;
+		r->y = 0;
+		r->width = line == s->max_lines-1 ? s->width : s->lw;
+	}
+	else {
+		r->x = 0;
+		r->y = line * dzen.line_height;
+		r->width = s->width;
+	}
+}
 
 void
 drawtext(const char *text, int reverse, int line, int align) {
+	XRectangle r;
+
+	slot_rect(line, &r);
 	if(!reverse) {
 		XSetForeground(dzen.dpy, dzen.gc, dzen.norm[ColBG]);
-		XFillRectangle(dzen.dpy, dzen.slave_win.drawable[line], dzen.gc, 0, 0, dzen.w, dzen.h);
+		XFillRectangle(dzen.dpy, dzen.slave_win.pm, dzen.gc, r.x, r.y, r.width, r.height);
 		XSetForeground(dzen.dpy, dzen.gc, dzen.norm[ColFG]);
 	}
 	else {
 		XSetForeground(dzen.dpy, dzen.rgc, dzen.norm[ColFG]);
-		XFillRectangle(dzen.dpy, dzen.slave_win.drawable[line], dzen.rgc, 0, 0, dzen.w, dzen.h);
+		XFillRectangle(dzen.dpy, dzen.slave_win.pm, dzen.rgc, r.x, r.y, r.width, r.height);
 		XSetForeground(dzen.dpy, dzen.rgc, dzen.norm[ColBG]);
 	}
 
 	parse_line(text, line, align, reverse, 0);
 }
 
-long
-getcolor(const char *colstr) {
+/* scale a 16 bit color component to the bits of mask */
+static unsigned long
+color_channel(unsigned short v, unsigned long mask) {
+	int shift = 0;
+
+	if(!mask)
+		return 0;
+	while(!(mask & 1)) {
+		mask >>= 1;
+		shift++;
+	}
+	return ((unsigned long)v * mask / 0xffff) << shift;
+}
+
+/* the slot of colstr, what another color left in it is given back */
+static color_c *
+color_slot(const char *colstr) {
+	color_c *c;
+
+	c = &colors[hashmem(colstr, strlen(colstr), HASH_INIT) % MAX_COLOR_CACHE];
+	if(c->name && strcmp(c->name, colstr)) {
+#ifdef DZEN_XFT
+		if(c->hasxft)
+			XftColorFree(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen),
+					DefaultColormap(dzen.dpy, dzen.screen), &c->xft);
+		c->hasxft = False;
+#endif
+		if(c->alloced)
+			XFreeColors(dzen.dpy, DefaultColormap(dzen.dpy, dzen.screen), &c->pixel, 1, 0);
+		c->alloced = False;
+		free(c->name);
+		c->name = NULL;
+	}
+	return c;
+}
+
+/* returns the pixel of colstr or -1, *alloced if it is a colormap cell */
+static long
+alloc_color(const char *colstr, Bool *alloced) {
 	Colormap cmap = DefaultColormap(dzen.dpy, dzen.screen);
+	Visual *vis = DefaultVisual(dzen.dpy, dzen.screen);
 	XColor color;
 
+	*alloced = False;
+	if(colstr[0] == '#' && vis->class == TrueColor
+			&& XParseColor(dzen.dpy, cmap, colstr, &color))
+		return color_channel(color.red, vis->red_mask)
+			| color_channel(color.green, vis->green_mask)
+			| color_channel(color.blue, vis->blue_mask);
 	if(!XAllocNamedColor(dzen.dpy, cmap, colstr, &color, &color))
 		return -1;
-
+	*alloced = True;
 	return color.pixel;
 }
 
-void
-setfont(const char *fontstr) {
+/*
+ * Colors are cached by name. On TrueColor visuals '#rgb' style colors
+ * are computed locally, everything else costs a round trip to the
+ * server the first time it is used. A cached colormap cell is given
+ * back when another color takes its slot, so the pixel is only good
+ * until the next getcolor().
+ */
+long
+getcolor(const char *colstr) {
+	color_c *c;
+	Bool alloced;
+	long pixel;
+
+	if((c = color_slot(colstr))->name)
+		return c->pixel;
+	if((pixel = alloc_color(colstr, &alloced)) == -1)
+		return -1;
+	c->name = estrdup(colstr);
+	c->pixel = pixel;
+	c->alloced = alloced;
+	return pixel;
+}
+
+/* a color of its own for the caller, not cached, e.g. the defaults */
+long
+newcolor(const char *colstr) {
+	Bool alloced;
+
+	return alloc_color(colstr, &alloced);
+}
+
+/*
+ * Color of a ^fg() or ^bg() op. Off TrueColor the pixel looked up when
+ * the line was compiled may have been given back to the server since,
+ * see color_slot(), so the color is looked up again by name.
+ */
+static unsigned long
+op_color(Dop *op, const char *name) {
+	if(name && DefaultVisual(dzen.dpy, dzen.screen)->class != TrueColor)
+		return getcolor(name);
+	return op->col;
+}
+
+#ifdef DZEN_XFT
+/* cached like getcolor(), unknown colors fall back to the default foreground */
+static XftColor *
+getxftcolor(const char *colstr) {
+	static XftColor none;	/* not even the default is known */
+	color_c *c;
+
+	/* also makes colstr the owner of its cache slot */
+	if(getcolor(colstr) == -1)
+		return strcmp(colstr, dzen.fg) ? getxftcolor(dzen.fg) : &none;
+
+	c = color_slot(colstr);
+	if(c->hasxft)
+		return &c->xft;
+	if(!XftColorAllocName(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen),
+				DefaultColormap(dzen.dpy, dzen.screen), colstr, &c->xft))
+		return &none;
+	c->hasxft = True;
+
+	return &c->xft;
+}
+#endif
+
+static void
+open_font(Fnt *f, const char *fontstr) {
 #ifndef DZEN_XFT
 	char *def, **missing;
 	int i, n;
 
 	missing = NULL;
-	if(dzen.font.set)
-		XFreeFontSet(dzen.dpy, dzen.font.set);
-
-	dzen.font.set = XCreateFontSet(dzen.dpy, fontstr, &missing, &n, &def);
+	f->xfont = NULL;
+	f->set = XCreateFontSet(dzen.dpy, fontstr, &missing, &n, &def);
 	if(missing)
 		XFreeStringList(missing);
 
-	if(dzen.font.set) {
-		XFontSetExtents *font_extents;
+	if(f->set) {
 		XFontStruct **xfonts;
 		char **font_names;
-		dzen.font.ascent = dzen.font.descent = 0;
-		font_extents = XExtentsOfFontSet(dzen.font.set);
-		n = XFontsOfFontSet(dzen.font.set, &xfonts, &font_names);
-		for(i = 0, dzen.font.ascent = 0, dzen.font.descent = 0; i < n; i++) {
-			if(dzen.font.ascent < (*xfonts)->ascent)
-				dzen.font.ascent = (*xfonts)->ascent;
-			if(dzen.font.descent < (*xfonts)->descent)
-				dzen.font.descent = (*xfonts)->descent;
+		n = XFontsOfFontSet(f->set, &xfonts, &font_names);
+		for(i = 0, f->ascent = 0, f->descent = 0; i < n; i++) {
+			if(f->ascent < (*xfonts)->ascent)
+				f->ascent = (*xfonts)->ascent;
+			if(f->descent < (*xfonts)->descent)
+				f->descent = (*xfonts)->descent;
 			xfonts++;
 		}
 	}
 	else {
-		if(dzen.font.xfont)
-			XFreeFont(dzen.dpy, dzen.font.xfont);
-		dzen.font.xfont = NULL;
-		if(!(dzen.font.xfont = XLoadQueryFont(dzen.dpy, fontstr)))
+		if(!(f->xfont = XLoadQueryFont(dzen.dpy, fontstr)))
 			eprint("dzen: error, cannot load font: '%s'\n", fontstr);
-		dzen.font.ascent = dzen.font.xfont->ascent;
-		dzen.font.descent = dzen.font.xfont->descent;
+		f->ascent = f->xfont->ascent;
+		f->descent = f->xfont->descent;
 	}
-	dzen.font.height = dzen.font.ascent + dzen.font.descent;
+	f->height = f->ascent + f->descent;
 #else
-	dzen.font.xftfont = XftFontOpenXlfd(dzen.dpy, dzen.screen, fontstr);
-	if(!dzen.font.xftfont)
-	   dzen.font.xftfont = XftFontOpenName(dzen.dpy, dzen.screen, fontstr);
-	if(!dzen.font.xftfont)
+	XGlyphInfo extents;
+
+	f->xftfont = XftFontOpenXlfd(dzen.dpy, dzen.screen, fontstr);
+	if(!f->xftfont)
+	   f->xftfont = XftFontOpenName(dzen.dpy, dzen.screen, fontstr);
+	if(!f->xftfont)
 	   eprint("error, cannot load font: '%s'\n", fontstr);
-	dzen.font.extents = malloc(sizeof(XGlyphInfo));
-	XftTextExtentsUtf8(dzen.dpy, dzen.font.xftfont, (unsigned const char *) fontstr, strlen(fontstr), dzen.font.extents);
-	dzen.font.height = dzen.font.xftfont->ascent + dzen.font.xftfont->descent;
-	dzen.font.width = (dzen.font.extents->width)/strlen(fontstr);
+	XftTextExtentsUtf8(dzen.dpy, f->xftfont, (unsigned const char *) fontstr, strlen(fontstr), &extents);
+	f->ascent = f->xftfont->ascent;
+	f->descent = f->xftfont->descent;
+	f->height = f->xftfont->ascent + f->xftfont->descent;
+	f->width = extents.width/strlen(fontstr);
+#endif
+	f->adv = adv_new();
+}
+
+static void
+close_font(Fnt *f) {
+#ifndef DZEN_XFT
+	if(f->set)
+		XFreeFontSet(dzen.dpy, f->set);
+	else if(f->xfont)
+		XFreeFont(dzen.dpy, f->xfont);
+	f->set = NULL;
+	f->xfont = NULL;
+#else
+	if(f->xftfont)
+		XftFontClose(dzen.dpy, f->xftfont);
+	f->xftfont = NULL;
 #endif
+	free(f->adv);
+	f->adv = NULL;
+}
+
+/* sets the default font */
+void
+setfont(const char *fontstr) {
+	close_font(&dzen.font);
+	open_font(&dzen.font, fontstr);
+}
+
+/*
+ * Fonts selected with ^fn() are opened once and kept by name. When the
+ * registry is full the least recently used font is closed. Fonts given
+ * with -fn-preload are only opened when ^fn(dfntN) first uses them.
+ */
+
+typedef struct FONT_C {
+	char *name;
+	Fnt fnt;
+	unsigned long used;
+} font_c;
+
+static font_c fonts[MAX_FONT_CACHE];
+static unsigned long font_clock = 0;
+
+static Fnt *
+getfont(const char *name) {
+	font_c *f, *lru = &fonts[0];
+	int i;
+
+	if(!strncmp(name, "dfnt", 4)) {
+		i = atoi(name+4);
+		if(i < 0 || i >= MAX_PRELOAD_FONTS || !dzen.fnpl[i])
+			return &dzen.font;
+		name = dzen.fnpl[i];
+	}
+
+	for(i=0; i < MAX_FONT_CACHE; i++) {
+		f = &fonts[i];
+		if(f->name && !strcmp(f->name, name)) {
+			f->used = ++font_clock;
+			return &f->fnt;
+		}
+		if(!f->name || f->used < lru->used)
+			lru = f;
+		if(!f->name)
+			break;
+	}
+
+	if(lru->name) {
+		close_font(&lru->fnt);
+		free(lru->name);
+	}
+	open_font(&lru->fnt, name);
+	lru->name = estrdup(name);
+	lru->used = ++font_clock;
+
+	return &lru->fnt;
+}
+
+void
+free_fonts(void) {
+	int i;
+
+	for(i=0; i < MAX_FONT_CACHE; i++)
+		if(fonts[i].name) {
+			close_font(&fonts[i].fnt);
+			free(fonts[i].name);
+			fonts[i].name = NULL;
+		}
+	close_font(&dzen.font);
 }
 
 
@@ -170,12 +603,16 @@ get_tokval(const char* line, char **retdata) {
 	int i;
 	char tokval[ARGLEN];
 
-	for(i=0; i < ARGLEN && (*(line+i) != ')'); i++)
+	for(i=0; i < ARGLEN-1 && *(line+i) && (*(line+i) != ')'); i++)
 		tokval[i] = *(line+i);
 
 	tokval[i] = '\0';
 	*retdata = strdup(tokval);
 
+	/* unterminated command at the end of a (cut) line */
+	if(!*(line+i))
+		return i;
+
 	return i+1;
 }
 
@@ -196,23 +633,261 @@ get_token(const char *line, int * t, char **tval) {
 			break;
 		}
 	}
-
+	/* unknown command, never skip past the end of the line */
+	if(!cmd_lookup_table[i].name)
+		off = strnlen(line, off);
 
 	*tval = tokval;
 	return next_pos+off;
 }
 
+/*
+ * Drawing primitives of render_line(). With -raster, rectangles, arcs
+ * and bitmaps go to the client-side rasterizer, see raster.c. Text and
+ * icons are still drawn by the server, after uploading what has been
+ * rasterized so far. Should a primitive cover columns the server has
+ * drawn to, the rest of the line is drawn with plain X requests.
+ *
+ * Without -raster, rectangles and arcs are collected in batches of the
+ * same kind and color and sent with a single XFillRectangles() and the
+ * like. A primitive may join an older batch as long as it does not
+ * overlap any batch opened after that one, batches are sent in the
+ * order they were opened. The foreground and background of the GC are
+ * only changed when a request needs other values.
+ */
+enum { FillRect, DrawRect, FillArc, DrawArc };
+
+typedef struct {
+	int kind;
+	unsigned long fg;
+	int x0, x1;
+	int n;
+	XRectangle r[MAX_BATCH];
+	XArc a[MAX_BATCH];
+} Batch;
+
+static Batch batches[MAX_BATCHES];
+static int nbatches = 0;
+
+static Bool rasterize = False;
+static Drawable pen_pm;
+#ifdef DZEN_XRENDER
+static Picture pen_pic;		/* pen_pm for XRenderComposite() */
+#endif
+static unsigned long pen_fg = 0, pen_bg = 1;
+static unsigned long gc_fg = 0, gc_bg = 1;	/* GC defaults */
+static int rx0, rx1;	/* rasterized, not uploaded yet */
+static int ox0, ox1;	/* drawn by the server */
+
+static void
+pen_gc(unsigned long fg, unsigned long bg) {
+	if(fg != gc_fg)
+		XSetForeground(dzen.dpy, dzen.tgc, gc_fg = fg);
+	if(bg != gc_bg)
+		XSetBackground(dzen.dpy, dzen.tgc, gc_bg = bg);
+}
+
+static void
+batch_flush(void) {
+	Batch *b;
+	int i;
+
+	for(i=0; i < nbatches; i++) {
+		b = &batches[i];
+		pen_gc(b->fg, gc_bg);
+		switch(b->kind) {
+			case FillRect:
+				XFillRectangles(dzen.dpy, pen_pm, dzen.tgc, b->r, b->n);
+				break;
+			case DrawRect:
+				XDrawRectangles(dzen.dpy, pen_pm, dzen.tgc, b->r, b->n);
+				break;
+			case FillArc:
+				XFillArcs(dzen.dpy, pen_pm, dzen.tgc, b->a, b->n);
+				break;
+			case DrawArc:
+				XDrawArcs(dzen.dpy, pen_pm, dzen.tgc, b->a, b->n);
+				break;
+		}
+	}
+	nbatches = 0;
+}
+
+/* returns the batch to add a primitive covering columns x0 to x1 to */
+static Batch *
+batch_get(int kind, int x0, int x1) {
+	Batch *b = NULL;
+	int i;
+
+	for(i=nbatches-1; i >= 0; i--) {
+		if(batches[i].kind == kind && batches[i].fg == pen_fg) {
+			b = &batches[i];
+			break;
+		}
+		if(x0 < batches[i].x1 && x1 > batches[i].x0)
+			break;
+	}
+	if(b && b->n == MAX_BATCH) {
+		batch_flush();
+		b = NULL;
+	}
+	if(!b) {
+		if(nbatches == MAX_BATCHES)
+			batch_flush();
+		b = &batches[nbatches++];
+		b->kind = kind;
+		b->fg = pen_fg;
+		b->x0 = INT_MAX;
+		b->x1 = INT_MIN;
+		b->n = 0;
+	}
+	b->x0 = MIN(b->x0, x0);
+	b->x1 = MAX(b->x1, x1);
+	return b;
+}
+
+static void
+batch_rect(int kind, int x, int y, int w, int h) {
+	Batch *b = batch_get(kind, x, x+w+1);
+	XRectangle *r = &b->r[b->n++];
+
+	r->x = x;
+	r->y = y;
+	r->width = w;
+	r->height = h;
+}
+
+static void
+batch_arc(int kind, int x, int y, int d, int a1, int a2) {
+	Batch *b = batch_get(kind, x, x+d+1);
+	XArc *a = &b->a[b->n++];
+
+	a->x = x;
+	a->y = y;
+	a->width = a->height = d;
+	a->angle1 = a1;
+	a->angle2 = a2;
+}
+
+static void
+pen_flush(void) {
+	if(rasterize && rx0 < rx1)
+		ras_put(pen_pm, dzen.gc, rx0, rx1);
+	rx0 = INT_MAX;
+	rx1 = INT_MIN;
+}
+
+static void
+pen_begin(Drawable pm, int w) {
+	pen_pm = pm;
+	rasterize = dzen.raster && ras_begin(w, dzen.line_height);
+	rx0 = ox0 = INT_MAX;
+	rx1 = ox1 = INT_MIN;
+}
+
+static void
+pen_end(void) {
+	batch_flush();
+	pen_flush();
+}
+
+/* returns True if columns x0 to x1 are to be rasterized */
+static Bool
+pen_raster(int x0, int x1) {
+	if(!rasterize)
+		return False;
+	if(MIN(rx0, x0) < ox1 && MAX(rx1, x1) > ox0) {
+		pen_flush();
+		if(x0 < ox1 && x1 > ox0) {
+			rasterize = False;
+			return False;
+		}
+	}
+	rx0 = MIN(rx0, x0);
+	rx1 = MAX(rx1, x1);
+	return True;
+}
+
+/* columns x0 to x1 are about to be drawn by the server with the GC */
+static void
+pen_server(int x0, int x1) {
+	batch_flush();
+	pen_gc(pen_fg, pen_bg);
+	if(!rasterize)
+		return;
+	pen_flush();
+	ox0 = MIN(ox0, x0);
+	ox1 = MAX(ox1, x1);
+}
+
+static void
+fill_rect(int x, int y, int w, int h) {
+	if(pen_raster(x, x+w))
+		ras_fill(x, y, w, h, pen_fg);
+	else
+		batch_rect(FillRect, x, y, w, h);
+}
+
+static void
+draw_rect(int x, int y, int w, int h) {
+	if(pen_raster(x, x+w+1))
+		ras_rect(x, y, w, h, pen_fg);
+	else
+		batch_rect(DrawRect, x, y, w, h);
+}
+
+static void
+draw_arc(int x, int y, int d, int a1, int a2, int fill) {
+	if(pen_raster(x, x+d))
+		ras_arc(x, y, d, a1, a2, fill, pen_fg);
+	else
+		batch_arc(fill ? FillArc : DrawArc, x, y, d, a1, a2);
+}
+
+static void
+draw_icon(int x, int y, Icon *ic) {
+	if(ic->type == IconXbm && pen_raster(x, x + ic->w)) {
+		ras_bitmap(x, y, ic->w, ic->h, ic->bits, pen_fg, pen_bg);
+		return;
+	}
+
+	pen_server(x, x + ic->w);
+#ifdef DZEN_XRENDER
+	/* blended over what is drawn below, e.g. the ^bg() color */
+	if(ic->type == IconArgb) {
+		if(pen_pic)
+			XRenderComposite(dzen.dpy, PictOpOver, ic->pic, None, pen_pic,
+					ic->sx, ic->sy, 0, 0, x, y, ic->w, ic->h);
+		return;
+	}
+#endif
+	if(ic->type == IconXbm) {
+		if(!ic->p)
+			ic->p = XCreateBitmapFromData(dzen.dpy, pen_pm, (char *)ic->bits, ic->w, ic->h);
+		XCopyPlane(dzen.dpy, ic->p, pen_pm, dzen.tgc, ic->sx, ic->sy, ic->w, ic->h, x, y, 1);
+	}
+	else if(ic->mask) {
+		/* preloaded XPM, the background shows through */
+		XSetClipMask(dzen.dpy, dzen.tgc, ic->mask);
+		XSetClipOrigin(dzen.dpy, dzen.tgc, x - ic->sx, y - ic->sy);
+		XCopyArea(dzen.dpy, ic->p, pen_pm, dzen.tgc, ic->sx, ic->sy, ic->w, ic->h, x, y);
+		XSetClipMask(dzen.dpy, dzen.tgc, None);
+	}
+	else
+		XCopyArea(dzen.dpy, ic->p, pen_pm, dzen.tgc, ic->sx, ic->sy, ic->w, ic->h, x, y);
+}
+
 static void
-setcolor(Drawable *pm, int x, int width, long tfg, long tbg, int reverse, int nobg) {
+setcolor(int x, int width, long tfg, long tbg, int reverse, int nobg) {
 
 	if(nobg)
 		return;
 
-	XSetForeground(dzen.dpy, dzen.tgc, reverse ? tfg : tbg);
-	XFillRectangle(dzen.dpy, *pm, dzen.tgc, x, 0, width, dzen.line_height);
+	pen_fg = reverse ? tfg : tbg;
+	fill_rect(x, 0, width, dzen.line_height);
 
-	XSetForeground(dzen.dpy, dzen.tgc, reverse ? tbg : tfg);
-	XSetBackground(dzen.dpy, dzen.tgc, reverse ? tfg : tbg);
+	pen_fg = reverse ? tbg : tfg;
+	pen_bg = reverse ? tfg : tbg;
 }
 
 int 
@@ -317,601 +992,1027 @@ get_block_align_vals(char *s, int *a, int *w)
 }
 
 
-static int
-search_icon_cache(const char* name) {
-	int i;
-
-	for(i=0; i < MAX_ICON_CACHE; i++)
-		if(!strncmp(icons[i].name, name, ARGLEN))
-			return i;
+/*
+ * Lines are drawn in two steps. compile_line() splits a line into a
+ * display list, one Dop for every in-text command holding its already
+ * parsed arguments and the text up to the next command. render_line()
+ * draws a display list. Binary frames (-proto binary) are decoded into
+ * a display list directly, see decode_frame().
+ */
 
-	return -1;
+static void
+dl_reset(Dlist *dl) {
+	dl->nops = 0;
+	dl->slen = 0;
 }
 
-#ifdef DZEN_XPM
-static void
-cache_icon(const char* name, Pixmap pm, int w, int h) {
-	if(icon_cnt >= MAX_ICON_CACHE)
-		icon_cnt = 0;
+static Dop *
+dl_op(Dlist *dl, int type) {
+	Dop *op;
 
-	if(icons[icon_cnt].p)
-		XFreePixmap(dzen.dpy, icons[icon_cnt].p);
+	if(dl->nops == dl->maxops) {
+		dl->maxops = dl->maxops ? 2*dl->maxops : 16;
+		dl->ops = erealloc(dl->ops, dl->maxops * sizeof(Dop));
+	}
+	op = &dl->ops[dl->nops++];
+	memset(op, 0, sizeof(Dop));
+	op->type = type;
+	op->arg = op->text = -1;
 
-	strncpy(icons[icon_cnt].name, name, ARGLEN);
-	icons[icon_cnt].w = w;
-	icons[icon_cnt].h = h;
-	icons[icon_cnt].p = pm;
-	icon_cnt++;
+	return op;
 }
-#endif
 
+/* returns the offset of the stored copy of s */
+static int
+dl_str(Dlist *dl, const char *s, size_t len) {
+	int off = dl->slen;
 
-char *
-parse_line(const char *line, int lnr, int align, int reverse, int nodraw) {
-	/* bitmaps */
-	unsigned int bm_w, bm_h;
-	int bm_xh, bm_yh;
-	/* rectangles, cirlcles*/
-	int rectw, recth, rectx, recty;
-	/* positioning */
-	int n_posx, n_posy, set_posy=0;
-	int px=0, py=0, opx=0;
-	int i, next_pos=0, j=0, h=0, tw=0;
-	/* buffer pos */
-	const char *linep=NULL;
-	/* fonts */
-	int font_was_set=0;
-	/* position */
-	int pos_is_fixed = 0;
-	/* block alignment */
-	int block_align = -1;
-	int block_width = -1;
-	/* clickable area y tracking */
-	int max_y=-1;
+	if(dl->slen + len + 1 > (size_t)dl->smax) {
+		while(dl->slen + len + 1 > (size_t)dl->smax)
+			dl->smax = dl->smax ? 2*dl->smax : 256;
+		dl->str = erealloc(dl->str, dl->smax);
+	}
+	memcpy(dl->str + off, s, len);
+	dl->str[off + len] = '\0';
+	dl->slen += len + 1;
 
-	/* temp buffers */
-	char lbuf[MAX_LINE_LEN], *rbuf = NULL;
+	return off;
+}
 
-	/* parser state */
-	int t=-1, nobg=0;
-	char *tval=NULL;
+static void
+compile_cmd(Dlist *dl, Dop *op, char *tval) {
+	char cmd[1024];
 
-	/* X stuff */
-	long lastfg = dzen.norm[ColFG], lastbg = dzen.norm[ColBG];
-	Fnt *cur_fnt = NULL;
-#ifndef DZEN_XFT
-	XGCValues gcv;
-#endif
-	Drawable pm=0, bm;
-#ifdef DZEN_XPM
-	int free_xpm_attrib = 0;
-	Pixmap xpm_pm;
-	XpmAttributes xpma;
-	XpmColorSymbol xpms;
-#endif
+	switch(op->type) {
+		case icon:
+			op->arg = dl_str(dl, tval, strlen(tval));
+			break;
+		case rect:
+		case recto:
+			op->r = get_rect_vals(tval, &op->a, &op->b, &op->c, &op->d);
+			break;
+		case circle:
+		case circleo:
+			op->r = get_circle_vals(tval, &op->a, &op->b);
+			break;
+		case pos:
+		case abspos:
+			op->r = tval[0] ? get_pos_vals(tval, &op->a, &op->b) : 0;
+			break;
+		case ibg:
+			op->a = atoi(tval);
+			break;
+		case bg:
+		case fg:
+			if(tval[0]) {
+				op->col = (unsigned)getcolor(tval);
+				op->arg = dl_str(dl, tval, strlen(tval));
+			} else
+				op->col = dzen.norm[op->type == fg ? ColFG : ColBG];
+			break;
+		case fn:
+			if(tval[0])
+				op->arg = dl_str(dl, tval, strlen(tval));
+			break;
+		case ca:
+			if(tval[0]) {
+				get_sens_area(tval, &op->a, cmd);
+				op->arg = dl_str(dl, cmd, strlen(cmd));
+			}
+			break;
+		case ba:
+			if(tval[0])
+				get_block_align_vals(tval, &op->a, &op->b);
+			else
+				op->a = op->b = -1;
+			break;
+		case region:
+			if(sscanf(tval, "%d;%d", &op->a, &op->b) < 2 || op->b < 0)
+				op->b = -1;
+			op->a = op->a < 0 ? 0 : op->a;
+			break;
+	}
+}
 
-#ifdef DZEN_XFT
-	XftDraw *xftd=NULL;
-	XftColor xftc;
-	char *xftcs;
-	int xftcs_f=0;
-	char *xftcs_bg;
-	int xftcs_bgf=0;
-
-	xftcs    = (char *)dzen.fg;
-    xftcs_bg = (char *)dzen.bg;
-#endif
+void
+compile_line(Dlist *dl, const char *line) {
+	const char *linep, *run;
+	char *tval;
+	int t, next_pos;
+	Dop *op;
 
-	/* icon cache */
-	int ip;
+	dl_reset(dl);
+	dl_op(dl, -1);
 
-	/* parse line and return the text without control commands */
-	if(nodraw) {
-		rbuf = emalloc(MAX_LINE_LEN);
-		rbuf[0] = '\0';
-		if( (lnr + dzen.slave_win.first_line_vis) >= dzen.slave_win.tcnt)
-			line = NULL;
+	for(linep = run = line; ; linep++) {
+		if(*linep != ESC_CHAR && *linep != '\0')
+			continue;
+
+		dl->ops[dl->nops-1].text = dl_str(dl, run, linep - run);
+		if(*linep == '\0')
+			break;
+
+		t=-1; tval=NULL;
+		next_pos = get_token(linep, &t, &tval);
+		linep += next_pos;
+
+		op = dl_op(dl, tval ? t : -1);
+		if(tval) {
+			compile_cmd(dl, op, tval);
+			free(tval);
+		}
+
+		/* ^^ escapes, the second ^ starts the text */
+		if(next_pos == 0 && *(linep+1) == ESC_CHAR)
+			run = ++linep;
 		else
-			line = dzen.slave_win.tbuf[dzen.slave_win.first_line_vis+lnr];
+			run = linep + 1;
+	}
+}
+
+/*
+ * Damage tracking for the title window.
+ *
+ * Every op of a title line is one segment, identified by a hash of the
+ * op and of the drawing state it starts with (position, colors, font),
+ * together with the x range it draws to. Segments that are equal in two
+ * consecutive renders produce the same pixels, so only the ranges of
+ * the others have to be copied to the title drawable and the window.
+ * Segments are matched by index, or from both ends if the number of ops
+ * changed. A moved title line (-ta, -expand) is redrawn in full.
+ */
+
+typedef struct {
+	unsigned long sig;
+	int x0, x1;
+} Seg;
+
+typedef struct {
+	Seg *segs;
+	int n, max;
+} Seglist;
+
+static Seglist segs_old, segs_new;
+static Bool segs_valid = False;
+static int segs_xo;
+
+/* x ranges of the title drawable changed by the last render */
+static struct {
+	int x0, x1;
+} damage[MAX_DAMAGE];
+static int ndamage = 0;
+
+/* whether n pixels at x leave a region that ends before the window does */
+#define OUTSIDE(x, n) (lim < dzen.w && (x) + (int)(n) > lim)
+#define EXTENT(x, w) do { sx0 = MIN(sx0, (x)); sx1 = MAX(sx1, (x)+(int)(w)); } while(0)
 
+static void
+add_seg(unsigned long sig, int x0, int x1) {
+	if(segs_new.n == segs_new.max) {
+		segs_new.max = segs_new.max ? 2*segs_new.max : 32;
+		segs_new.segs = erealloc(segs_new.segs, segs_new.max * sizeof(Seg));
 	}
-	/* parse line and render text */
-	else {
-		h = dzen.font.height;
-		py = (dzen.line_height - h) / 2;
-		xorig = 0;
+	/* ops that did not draw anything */
+	if(x0 >= x1)
+		x0 = x1 = 0;
+	segs_new.segs[segs_new.n].sig = sig;
+	segs_new.segs[segs_new.n].x0 = x0;
+	segs_new.segs[segs_new.n].x1 = x1;
+	segs_new.n++;
+}
 
+static unsigned long
+seg_sig(Dlist *dl, Dop *op, const long *state, size_t nstate) {
+	long v[] = { op->type, op->a, op->b, op->c, op->d, op->r, (long)op->col };
+	unsigned long h;
 
-		if(lnr != -1) {
-			pm = XCreatePixmap(dzen.dpy, RootWindow(dzen.dpy, DefaultScreen(dzen.dpy)), dzen.slave_win.width,
-					dzen.line_height, DefaultDepth(dzen.dpy, dzen.screen));
-		}
+	h = hashmem(v, sizeof v, HASH_INIT);
+	h = hashmem(state, nstate * sizeof(long), h);
+	if(op->arg != -1)
+		h = hashmem(dl->str + op->arg, strlen(dl->str + op->arg) + 1, h);
+	if(op->text != -1)
+		h = hashmem(dl->str + op->text, strlen(dl->str + op->text), h);
+
+	return h;
+}
+
+static void
+add_damage(int x0, int x1) {
+	int i;
+
+	x0 = MAX(x0, 0);
+	x1 = MIN(x1, dzen.title_win.width);
+	if(x0 >= x1)
+		return;
+
+	for(i=0; i < ndamage; i++)
+		if(x0 <= damage[i].x1 && x1 >= damage[i].x0)
+			break;
+	if(i == ndamage) {
+		/* out of ranges, grow the last one */
+		if(ndamage == MAX_DAMAGE)
+			i = MAX_DAMAGE-1;
 		else {
-			pm = XCreatePixmap(dzen.dpy, RootWindow(dzen.dpy, DefaultScreen(dzen.dpy)), dzen.title_win.width,
-					dzen.line_height, DefaultDepth(dzen.dpy, dzen.screen));
-			sens_areas_cnt = 0;
+			damage[ndamage].x0 = x0;
+			damage[ndamage].x1 = x1;
+			ndamage++;
+			return;
+		}
+	}
+	damage[i].x0 = MIN(damage[i].x0, x0);
+	damage[i].x1 = MAX(damage[i].x1, x1);
+}
+
+static int
+seg_eq(Seg *a, Seg *b) {
+	return a->sig == b->sig && a->x0 == b->x0 && a->x1 == b->x1;
+}
+
+/* compare the segments of the new title line with the last one */
+static void
+damage_title(int xo, int full) {
+	Seg *o = segs_old.segs, *n = segs_new.segs;
+	int no = segs_old.n, nn = segs_new.n;
+	int i, j, k;
+	Seglist t;
+
+	ndamage = 0;
+	if(full || !segs_valid || xo != segs_xo)
+		add_damage(0, dzen.title_win.width);
+	else {
+		for(i=0; i < no && i < nn && seg_eq(&o[i], &n[i]); i++)
+			;
+		for(j=0; j < no-i && j < nn-i && seg_eq(&o[no-1-j], &n[nn-1-j]); j++)
+			;
+		for(k=i; k < MAX(no, nn)-j; k++) {
+			if(no == nn && seg_eq(&o[k], &n[k]))
+				continue;
+			if(k < no-j)
+				add_damage(o[k].x0 + xo, o[k].x1 + xo);
+			if(k < nn-j)
+				add_damage(n[k].x0 + xo, n[k].x1 + xo);
 		}
+	}
+
+	t = segs_old;
+	segs_old = segs_new;
+	segs_new = t;
+	segs_new.n = 0;
+	segs_valid = True;
+	segs_xo = xo;
+}
+
+/*
+ * Lines are drawn into a scratch pixmap first. There is one for the
+ * title and one for the slave window lines, kept for the lifetime of
+ * dzen and only recreated if the width or depth changes.
+ */
+
+typedef struct {
+	Pixmap pm;
+	int w, depth;
+#ifdef DZEN_XFT
+	XftDraw *xftd;
+#endif
+#ifdef DZEN_XRENDER
+	Picture pic;			/* 0 if the server has no RENDER */
+#endif
+} Surface;
 
+static Surface title_surface, slave_surface;
+
+static void
+put_surface(Surface *sf) {
+	if(!sf->pm)
+		return;
 #ifdef DZEN_XFT
-		xftd = XftDrawCreate(dzen.dpy, pm, DefaultVisual(dzen.dpy, dzen.screen), 
-				DefaultColormap(dzen.dpy, dzen.screen));
+	XftDrawDestroy(sf->xftd);
 #endif
+#ifdef DZEN_XRENDER
+	if(sf->pic)
+		XRenderFreePicture(dzen.dpy, sf->pic);
+#endif
+	XFreePixmap(dzen.dpy, sf->pm);
+	sf->pm = 0;
+}
 
-		if(!reverse) {
-			XSetForeground(dzen.dpy, dzen.tgc, dzen.norm[ColBG]);
-#ifdef DZEN_XPM
-			xpms.pixel = dzen.norm[ColBG];
+static Surface *
+get_surface(Surface *sf, int w) {
+	int depth = DefaultDepth(dzen.dpy, dzen.screen);
+#ifdef DZEN_XRENDER
+	XRenderPictFormat *fmt;
+	int evbase, errbase;
 #endif
+
+	if(sf->pm && sf->w == w && sf->depth == depth)
+		return sf;
+
+	put_surface(sf);
+	sf->pm = XCreatePixmap(dzen.dpy, RootWindow(dzen.dpy, DefaultScreen(dzen.dpy)), w,
+			dzen.line_height, depth);
+	sf->w = w;
+	sf->depth = depth;
 #ifdef DZEN_XFT
-			xftcs_bg = (char *)dzen.bg;
-			xftcs_bgf = 0;
+	sf->xftd = XftDrawCreate(dzen.dpy, sf->pm, DefaultVisual(dzen.dpy, dzen.screen), 
+			DefaultColormap(dzen.dpy, dzen.screen));
 #endif
-		}
-		else {
-			XSetForeground(dzen.dpy, dzen.tgc, dzen.norm[ColFG]);
-#ifdef DZEN_XPM
-			xpms.pixel = dzen.norm[ColFG];
+#ifdef DZEN_XRENDER
+	sf->pic = 0;
+	if(XRenderQueryExtension(dzen.dpy, &evbase, &errbase)
+			&& (fmt = XRenderFindVisualFormat(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen))))
+		sf->pic = XRenderCreatePicture(dzen.dpy, sf->pm, fmt, 0, NULL);
 #endif
-		}
-		XFillRectangle(dzen.dpy, pm, dzen.tgc, 0, 0, dzen.w, dzen.h);
+	return sf;
+}
 
-		if(!reverse) {
-			XSetForeground(dzen.dpy, dzen.tgc, dzen.norm[ColFG]);
-		}
-		else {
-			XSetForeground(dzen.dpy, dzen.tgc, dzen.norm[ColBG]);
-		}
+void
+free_surfaces(void) {
+	put_surface(&title_surface);
+	put_surface(&slave_surface);
+}
+
+/* the title drawn last shows an icon that is still being read */
+static Bool title_waits = False;
+
+static void
+render_line(Dlist *dl, int lnr, int align, int reverse) {
+	/* rectangles, cirlcles*/
+	int rectw=0, recth, rectx, recty;
+	/* positioning */
+	int n_posx, n_posy, set_posy=0;
+	int px=0, py=0, opx=0, xo=0;
+	int i, j, h=0, tw=0, k, maxw;
+	/* position */
+	int pos_is_fixed = 0;
+	/* block alignment */
+	int block_align = -1;
+	int block_width = -1;
+	/* region of the line drawn to, see ^rg() */
+	int rgx = 0, lim = dzen.w;
+	/* clickable area y tracking */
+	int max_y=-1;
+	/* title segments */
+	int sx0=INT_MAX, sx1=INT_MIN;
+	unsigned long fnh = HASH_INIT, sig = 0;
 
-#ifdef DZEN_XPM
-		xpms.name = NULL;
-		xpms.value = (char *)"none";
+	const char *tval, *text;
+	Dop *op;
+	int nobg=0;
 
-		xpma.colormap = DefaultColormap(dzen.dpy, dzen.screen);
-		xpma.depth = DefaultDepth(dzen.dpy, dzen.screen);
-		xpma.visual = DefaultVisual(dzen.dpy, dzen.screen);
-		xpma.colorsymbols = &xpms;
-		xpma.numsymbols = 1;
-		xpma.valuemask = XpmColormap|XpmDepth|XpmVisual|XpmColorSymbols;
+	/* X stuff */
+	long lastfg = dzen.norm[ColFG], lastbg = dzen.norm[ColBG];
+	Fnt *cur_fnt = NULL;
+#ifndef DZEN_XFT
+	XGCValues gcv;
 #endif
+	Drawable pm=0;
 
-#ifndef DZEN_XFT 
-		if(!dzen.font.set){
-			gcv.font = dzen.font.xfont->fid;
-			XChangeGC(dzen.dpy, dzen.tgc, GCFont, &gcv);
-		}
+#ifdef DZEN_XFT
+	XftDraw *xftd=NULL;
+	const char *xftcs;
+	const char *xftcs_bg;
+
+	xftcs    = dzen.fg;
+	xftcs_bg = dzen.bg;
 #endif
-		cur_fnt = &dzen.font;
 
-		if( lnr != -1 && (lnr + dzen.slave_win.first_line_vis >= dzen.slave_win.tcnt)) {
-			XCopyArea(dzen.dpy, pm, dzen.slave_win.drawable[lnr], dzen.gc,
-					0, 0, px, dzen.line_height, xorig, 0);
-			XFreePixmap(dzen.dpy, pm);
-			return NULL;
-		}
+	/* icons, transparent XPM pixels get the default background */
+	Icon *ic;
+	unsigned long iconbg = reverse ? dzen.norm[ColFG] : dzen.norm[ColBG];
+
+	Surface *sf;
+	XRectangle slot;
+
+	h = dzen.font.height;
+	py = (dzen.line_height - h) / 2;
+
+	sf = get_surface(lnr != -1 ? &slave_surface : &title_surface,
+			lnr != -1 ? dzen.slave_win.width : dzen.title_win.width);
+	pm = sf->pm;
+#ifdef DZEN_XFT
+	xftd = sf->xftd;
+#endif
+	pen_begin(pm, sf->w);
+#ifdef DZEN_XRENDER
+	pen_pic = sf->pic;
+#endif
+	if(lnr == -1) {
+		sens_areas_cnt = 0;
+		title_waits = False;
 	}
 
-	linep = line;
-	while(1) {
-		if(*linep == ESC_CHAR || *linep == '\0') {
-			lbuf[j] = '\0';
+	if(!reverse) {
+		pen_fg = dzen.norm[ColBG];
+	}
+	else {
+		pen_fg = dzen.norm[ColFG];
+	}
+	fill_rect(0, 0, dzen.w, dzen.h);
 
-			/* clear _lock_x at EOL so final width is correct */
-			if(*linep=='\0')
-				pos_is_fixed=0;
+	if(!reverse) {
+		pen_fg = dzen.norm[ColFG];
+	}
+	else {
+		pen_fg = dzen.norm[ColBG];
+	}
 
-			if(nodraw) {
-				strcat(rbuf, lbuf);
-			}
-			else {
-				if(t != -1 && tval) {
-					switch(t) {
-						case icon:
-							if(MAX_ICON_CACHE && (ip=search_icon_cache(tval)) != -1) {
-								int y;
-								XCopyArea(dzen.dpy, icons[ip].p, pm, dzen.tgc,
-										0, 0, icons[ip].w, icons[ip].h, px, y=(set_posy ? py :
-										(dzen.line_height >= (signed)icons[ip].h ?
-										(dzen.line_height - icons[ip].h)/2 : 0)));
-								px += !pos_is_fixed ? icons[ip].w : 0;
-								max_y = MAX(max_y, y+icons[ip].h);
-							} else {
-								int y;
-								if(XReadBitmapFile(dzen.dpy, pm, tval, &bm_w,
-											&bm_h, &bm, &bm_xh, &bm_yh) == BitmapSuccess
-										&& (h/2 + px + (signed)bm_w < dzen.w)) {
-									setcolor(&pm, px, bm_w, lastfg, lastbg, reverse, nobg);
-
-									XCopyPlane(dzen.dpy, bm, pm, dzen.tgc,
-											0, 0, bm_w, bm_h, px, y=(set_posy ? py :
-											(dzen.line_height >= (int)bm_h ?
-												(dzen.line_height - (int)bm_h)/2 : 0)), 1);
-									XFreePixmap(dzen.dpy, bm);
-									px += !pos_is_fixed ? bm_w : 0;
-									max_y = MAX(max_y, y+bm_h);
-								}
-#ifdef DZEN_XPM
-								else if(XpmReadFileToPixmap(dzen.dpy, dzen.title_win.win, tval, &xpm_pm, NULL, &xpma) == XpmSuccess) {
-									setcolor(&pm, px, xpma.width, lastfg, lastbg, reverse, nobg);
-
-									if(MAX_ICON_CACHE)
-										cache_icon(tval, xpm_pm, xpma.width, xpma.height);
-
-									XCopyArea(dzen.dpy, xpm_pm, pm, dzen.tgc,
-											0, 0, xpma.width, xpma.height, px, y=(set_posy ? py :
-											(dzen.line_height >= (int)xpma.height ?
-												(dzen.line_height - (int)xpma.height)/2 : 0)));
-									px += !pos_is_fixed ? xpma.width : 0;
-									max_y = MAX(max_y, y+xpma.height);
-
-									/* freed by cache_icon() */
-									//XFreePixmap(dzen.dpy, xpm_pm);
-									free_xpm_attrib = 1;
-								}
+#ifndef DZEN_XFT 
+	if(!dzen.font.set){
+		gcv.font = dzen.font.xfont->fid;
+		XChangeGC(dzen.dpy, dzen.tgc, GCFont, &gcv);
+	}
 #endif
-							}
-							break;
-
-
-						case rect:
-							get_rect_vals(tval, &rectw, &recth, &rectx, &recty);
-							recth = recth > dzen.line_height ? dzen.line_height : recth;
-							if(set_posy)
-								py += recty;
-							recty =	recty == 0 ? (dzen.line_height - recth)/2 :
-								(dzen.line_height - recth)/2 + recty;
-							px += !pos_is_fixed ? rectx : 0;
-							setcolor(&pm, px, rectw, lastfg, lastbg, reverse, nobg);
-
-							XFillRectangle(dzen.dpy, pm, dzen.tgc, px,
-									set_posy ? py :
-									((int)recty < 0 ? dzen.line_height + recty : recty),
-									rectw, recth);
-
-							px += !pos_is_fixed ? rectw : 0;
-							break;
-
-						case recto:
-							get_rect_vals(tval, &rectw, &recth, &rectx, &recty);
-							if (!rectw) break;
-
-							recth = recth > dzen.line_height ? dzen.line_height-2 : recth-1;
-							if(set_posy)
-								py += recty;
-							recty =	recty == 0 ? (dzen.line_height - recth)/2 :
-								(dzen.line_height - recth)/2 + recty;
-							px = (rectx == 0) ? px : rectx+px;
-							/* prevent from stairs effect when rounding recty */
-							if (!((dzen.line_height - recth) % 2)) recty--;
-							setcolor(&pm, px, rectw, lastfg, lastbg, reverse, nobg);
-							XDrawRectangle(dzen.dpy, pm, dzen.tgc, px,
-									set_posy ? py :
-									((int)recty<0 ? dzen.line_height + recty : recty), rectw-1, recth);
-							px += !pos_is_fixed ? rectw : 0;
-							break;
-
-						case circle:
-							rectx = get_circle_vals(tval, &rectw, &recth);
-							setcolor(&pm, px, rectw, lastfg, lastbg, reverse, nobg);
-							XFillArc(dzen.dpy, pm, dzen.tgc, px, set_posy ? py :(dzen.line_height - rectw)/2,
-									rectw, rectw, 90*64, rectx>1?recth*64:64*360);
-							px += !pos_is_fixed ? rectw : 0;
-							break;
-
-						case circleo:
-							rectx = get_circle_vals(tval, &rectw, &recth);
-							setcolor(&pm, px, rectw, lastfg, lastbg, reverse, nobg);
-							XDrawArc(dzen.dpy, pm, dzen.tgc, px, set_posy ? py : (dzen.line_height - rectw)/2,
-									rectw, rectw, 90*64, rectx>1?recth*64:64*360);
-							px += !pos_is_fixed ? rectw : 0;
-							break;
-
-						case pos:
-							if(tval[0]) {
-								int r=0;
-								r = get_pos_vals(tval, &n_posx, &n_posy);
-								if( (r == 1 && !set_posy))
-									set_posy=0;
-								else if (r == 5) {
-									switch(n_posx) {
-										case LOCK_X:
-											pos_is_fixed = 1;
-											break;
-										case UNLOCK_X:
-											pos_is_fixed = 0;
-											break;
-										case LEFT:
-											px = 0;
-											break;
-										case RIGHT:
-											px = dzen.w;
-											break;
-										case CENTER:
-											px = dzen.w/2;
-											break;
-										case BOTTOM:
-											set_posy = 1;
-											py = dzen.line_height;
-											break;
-										case TOP:
-											set_posy = 1;
-											py = 0;
-											break;
-									}
-								} else
-									set_posy=1;
-
-								if(r != 2)
-									px = px+n_posx<0? 0 : px + n_posx;
-								if(r != 1) 
-									py += n_posy;
-							} else {
-								set_posy = 0;
-								py = (dzen.line_height - dzen.font.height) / 2;
-							}
-							break;
-
-						case abspos:
-							if(tval[0]) {
-								int r=0;
-								if( (r=get_pos_vals(tval, &n_posx, &n_posy)) == 1 && !set_posy)
-									set_posy=0;
-								else
-									set_posy=1;
-
-								n_posx = n_posx < 0 ? n_posx*-1 : n_posx;
-								if(r != 2)
-									px = n_posx;
-								if(r != 1)
-									py = n_posy;
-							} else {
-								set_posy = 0;
-								py = (dzen.line_height - dzen.font.height) / 2;
-							}
-							break;
-
-						case ibg:
-							nobg = atoi(tval);
-							break;
-
-						case bg:
-							lastbg = tval[0] ? (unsigned)getcolor(tval) : dzen.norm[ColBG];
-#ifdef DZEN_XFT
-							if(xftcs_bgf) free(xftcs_bg);				
-							if(tval[0]) {
-								xftcs_bg = estrdup(tval);
-								xftcs_bgf = 1;
-							} else {
-								xftcs_bg = (char *)dzen.bg;
-								xftcs_bgf = 0;
-							}
-#endif							
-
-							break;
-
-						case fg:
-							lastfg = tval[0] ? (unsigned)getcolor(tval) : dzen.norm[ColFG];
-							XSetForeground(dzen.dpy, dzen.tgc, lastfg);
-#ifdef DZEN_XFT
-							if(tval[0]) {
-								xftcs = estrdup(tval);
-								xftcs_f = 1;
-							} else {
-								xftcs = (char *)dzen.fg;
-								xftcs_f = 0;
-							}
-#endif							
-							break;
-
-						case fn:
-							if(tval[0]) {
-#ifndef DZEN_XFT		
-								if(!strncmp(tval, "dfnt", 4)) {
-									cur_fnt = &(dzen.fnpl[atoi(tval+4)]);
-
-									if(!cur_fnt->set) {
-										gcv.font = cur_fnt->xfont->fid;
-										XChangeGC(dzen.dpy, dzen.tgc, GCFont, &gcv);
-									}
-								}
-								else
-#endif					
-									setfont(tval);
-							}
-							else {
-								cur_fnt = &dzen.font;
-#ifndef DZEN_XFT		
-								if(!cur_fnt->set){
-									gcv.font = cur_fnt->xfont->fid;
-									XChangeGC(dzen.dpy, dzen.tgc, GCFont, &gcv);
-								}
-#else
-							setfont(dzen.fnt ? dzen.fnt : FONT);
-#endif								
-							}
-							py = set_posy ? py : (dzen.line_height - cur_fnt->height) / 2;
-							font_was_set = 1;
-							break;
-						case ca:
-							if(lnr == -1) {
-								if(tval[0]) {
-									if(sens_areas_cnt < MAX_CLICKABLE_AREAS) {
-										get_sens_area(tval, 
-												&sens_areas[sens_areas_cnt].button, 
-												sens_areas[sens_areas_cnt].cmd);
-										sens_areas[sens_areas_cnt].start_x = px;
-										sens_areas[sens_areas_cnt].start_y = py;
-										sens_areas[sens_areas_cnt].end_y = py;
-										max_y = py;
-                                        sens_areas[sens_areas_cnt].active = 0;
-                                        sens_areas_cnt++;
-									}
-								} else {
-                                        /* find most recent unclosed area */
-                                        for(i = sens_areas_cnt - 1; i >= 0; i--)
-                                            if(!sens_areas[i].active)
-                                                break;
-                                        if(i >= 0 && i < MAX_CLICKABLE_AREAS) {
-                                            sens_areas[i].end_x = px;
-                                            sens_areas[i].end_y = max_y;
-                                            sens_areas[i].active = 1;
-
-									}
-								}
-							}
-							break;
-						case ba:
-							if(tval[0])
-								get_block_align_vals(tval, &block_align, &block_width);
-							else
-								block_align=block_width=-1;
-							break;
-					}
-					free(tval);
-				}
+	cur_fnt = &dzen.font;
 
-				/* check if text is longer than window's width */
-				tw = textnw(cur_fnt, lbuf, strlen(lbuf));
-				while((((tw + px) > (dzen.w)) || (block_align!=-1 && tw>block_width)) && j>=0) {
-					lbuf[--j] = '\0';
-					tw = textnw(cur_fnt, lbuf, strlen(lbuf));
-				}
-				
-				opx = px;
+	for(k=0; k < dl->nops; k++) {
+		op = &dl->ops[k];
+		tval = op->arg != -1 ? dl->str + op->arg : NULL;
+		text = op->text != -1 ? dl->str + op->text : "";
 
-				/* draw background for block */
-				if(block_align!=-1 && !nobg) {
-					setcolor(&pm, px, rectw, lastbg, lastbg, 0, nobg);
-					XFillRectangle(dzen.dpy, pm, dzen.tgc, px, 0, block_width, dzen.line_height);
-				}
+		/* clear _lock_x at EOL so final width is correct */
+		if(k == dl->nops-1)
+			pos_is_fixed=0;
 
-				if(block_align==ALIGNRIGHT)
-					px += (block_width - tw);
-				else if(block_align==ALIGNCENTER)
-					px += (block_width/2) - (tw/2);
+		if(lnr == -1) {
+			long state[] = { px, py, set_posy, pos_is_fixed, lastfg, lastbg,
+				nobg, (long)fnh, k == dl->nops-1, dzen.w, reverse, rgx, lim };
 
-				if(!nobg)
-					setcolor(&pm, px, tw, lastfg, lastbg, reverse, nobg);
-				
-#ifndef DZEN_XFT
-				if(cur_fnt->set)
-					XmbDrawString(dzen.dpy, pm, cur_fnt->set,
-							dzen.tgc, px, py + cur_fnt->ascent, lbuf, strlen(lbuf));
-				else
-					XDrawString(dzen.dpy, pm, dzen.tgc, px, py+dzen.font.ascent, lbuf, strlen(lbuf));
-#else
-				if(reverse) {
-				XftColorAllocName(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen),
-						DefaultColormap(dzen.dpy, dzen.screen),  xftcs_bg,  &xftc);
-				} else {
-				XftColorAllocName(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen),
-						DefaultColormap(dzen.dpy, dzen.screen),  xftcs,  &xftc);
+			sig = seg_sig(dl, op, state, sizeof state / sizeof state[0]);
+			sx0 = INT_MAX;
+			sx1 = INT_MIN;
+		}
+
+		switch(op->type) {
+			case icon:
+				if((ic = icon_get(tval, iconbg)) && !OUTSIDE(px, ic->w)
+						&& (ic->type != IconXbm || h/2 + px + ic->w < dzen.w)) {
+					int y = set_posy ? py : (dzen.line_height >= ic->h ?
+							(dzen.line_height - ic->h)/2 : 0);
+
+					setcolor(px, ic->w, lastfg, lastbg, reverse, nobg);
+					/* the space is kept free until the file is read */
+					if(ic->type != IconPending)
+						draw_icon(px, y, ic);
+					else if(lnr == -1)
+						title_waits = True;
+					EXTENT(px, ic->w);
+					px += !pos_is_fixed ? ic->w : 0;
+					max_y = MAX(max_y, y + ic->h);
 				}
+				break;
 
-				XftDrawStringUtf8(xftd, &xftc, 
-						cur_fnt->xftfont, px, py + dzen.font.xftfont->ascent, (const FcChar8 *)lbuf, strlen(lbuf));
 
-				if(xftcs_f) {
-					free(xftcs);
-					xftcs_f = 0;
-				}
-				if(xftcs_bgf) {
-					free(xftcs_bg);
-					xftcs_bgf = 0;
-				}
+			case rect:
+				rectw = op->a; recth = op->b; rectx = op->c; recty = op->d;
+				recth = recth > dzen.line_height ? dzen.line_height : recth;
+				if(set_posy)
+					py += recty;
+				recty =	recty == 0 ? (dzen.line_height - recth)/2 :
+					(dzen.line_height - recth)/2 + recty;
+				px += !pos_is_fixed ? rectx : 0;
+				if(OUTSIDE(px, rectw))
+					rectw = MAX(0, lim - px);
+				setcolor(px, rectw, lastfg, lastbg, reverse, nobg);
+
+				fill_rect(px, set_posy ? py :
+						((int)recty < 0 ? dzen.line_height + recty : recty),
+						rectw, recth);
+
+				EXTENT(px, rectw);
+				px += !pos_is_fixed ? rectw : 0;
+				break;
 
-#endif
+			case recto:
+				rectw = op->a; recth = op->b; rectx = op->c; recty = op->d;
+				if (!rectw) break;
+
+				recth = recth > dzen.line_height ? dzen.line_height-2 : recth-1;
+				if(set_posy)
+					py += recty;
+				recty =	recty == 0 ? (dzen.line_height - recth)/2 :
+					(dzen.line_height - recth)/2 + recty;
+				px = (rectx == 0) ? px : rectx+px;
+				/* prevent from stairs effect when rounding recty */
+				if (!((dzen.line_height - recth) % 2)) recty--;
+				if(OUTSIDE(px, rectw))
+					break;
+				setcolor(px, rectw, lastfg, lastbg, reverse, nobg);
+				draw_rect(px, set_posy ? py :
+						((int)recty<0 ? dzen.line_height + recty : recty), rectw-1, recth);
+				EXTENT(px, rectw);
+				px += !pos_is_fixed ? rectw : 0;
+				break;
+
+			case circle:
+				rectw = op->a; recth = op->b;
+				if(OUTSIDE(px, rectw))
+					break;
+				setcolor(px, rectw, lastfg, lastbg, reverse, nobg);
+				draw_arc(px, set_posy ? py :(dzen.line_height - rectw)/2,
+						rectw, 90*64, op->r>1?recth*64:64*360, 1);
+				EXTENT(px, rectw);
+				px += !pos_is_fixed ? rectw : 0;
+				break;
 
-				max_y = MAX(max_y, py+dzen.font.height);
+			case circleo:
+				rectw = op->a; recth = op->b;
+				if(OUTSIDE(px, rectw))
+					break;
+				setcolor(px, rectw, lastfg, lastbg, reverse, nobg);
+				draw_arc(px, set_posy ? py : (dzen.line_height - rectw)/2,
+						rectw, 90*64, op->r>1?recth*64:64*360, 0);
+				EXTENT(px, rectw);
+				px += !pos_is_fixed ? rectw : 0;
+				break;
 
-				if(block_align==-1) {
-					if(!pos_is_fixed || *linep =='\0')
-						px += tw;
+			case pos:
+				if(op->r) {
+					n_posx = op->a; n_posy = op->b;
+					if( (op->r == 1 && !set_posy))
+						set_posy=0;
+					else if (op->r == 5) {
+						switch(n_posx) {
+							case LOCK_X:
+								pos_is_fixed = 1;
+								break;
+							case UNLOCK_X:
+								pos_is_fixed = 0;
+								break;
+							case LEFT:
+								px = rgx;
+								break;
+							case RIGHT:
+								px = lim;
+								break;
+							case CENTER:
+								px = rgx + (lim - rgx)/2;
+								break;
+							case BOTTOM:
+								set_posy = 1;
+								py = dzen.line_height;
+								break;
+							case TOP:
+								set_posy = 1;
+								py = 0;
+								break;
+						}
+					} else
+						set_posy=1;
+
+					if(op->r != 2)
+						px = px+n_posx<0? 0 : px + n_posx;
+					if(op->r != 1) 
+						py += n_posy;
 				} else {
-					if(pos_is_fixed)
-						px = opx;
+					set_posy = 0;
+					py = (dzen.line_height - cur_fnt->height) / 2;
+				}
+				break;
+
+			case abspos:
+				if(op->r) {
+					n_posx = op->a; n_posy = op->b;
+					if(op->r == 1 && !set_posy)
+						set_posy=0;
 					else
-						px = opx+block_width;
+						set_posy=1;
+
+					n_posx = n_posx < 0 ? n_posx*-1 : n_posx;
+					if(op->r != 2)
+						px = rgx + n_posx;
+					if(op->r != 1)
+						py = n_posy;
+				} else {
+					set_posy = 0;
+					py = (dzen.line_height - cur_fnt->height) / 2;
 				}
+				break;
 
-				block_align=block_width=-1;
-			}
+			case ibg:
+				nobg = op->a;
+				break;
+
+			case bg:
+				lastbg = op_color(op, tval);
+#ifdef DZEN_XFT
+				xftcs_bg = tval ? tval : dzen.bg;
+#endif
+				break;
+
+			case fg:
+				lastfg = op_color(op, tval);
+				pen_fg = lastfg;
+#ifdef DZEN_XFT
+				xftcs = tval ? tval : dzen.fg;
+#endif
+				break;
 
-			if(*linep=='\0')
+			case fn:
+				cur_fnt = tval ? getfont(tval) : &dzen.font;
+#ifndef DZEN_XFT		
+				if(!cur_fnt->set){
+					gcv.font = cur_fnt->xfont->fid;
+					XChangeGC(dzen.dpy, dzen.tgc, GCFont, &gcv);
+				}
+#endif								
+				py = set_posy ? py : (dzen.line_height - cur_fnt->height) / 2;
+				fnh = tval ? hashmem(tval, strlen(tval), HASH_INIT) : HASH_INIT;
+				break;
+			case ca:
+				if(lnr == -1) {
+					if(tval) {
+						if(sens_areas_cnt < MAX_CLICKABLE_AREAS) {
+							sens_areas[sens_areas_cnt].button = op->a;
+							snprintf(sens_areas[sens_areas_cnt].cmd,
+									sizeof sens_areas[sens_areas_cnt].cmd, "%s", tval);
+							sens_areas[sens_areas_cnt].start_x = px;
+							sens_areas[sens_areas_cnt].start_y = py;
+							sens_areas[sens_areas_cnt].end_y = py;
+							max_y = py;
+							sens_areas[sens_areas_cnt].active = 0;
+							sens_areas_cnt++;
+						}
+					} else {
+							/* find most recent unclosed area */
+							for(i = sens_areas_cnt - 1; i >= 0; i--)
+								if(!sens_areas[i].active)
+									break;
+							if(i >= 0 && i < MAX_CLICKABLE_AREAS) {
+								sens_areas[i].end_x = px;
+								sens_areas[i].end_y = max_y;
+								sens_areas[i].active = 1;
+
+						}
+					}
+				}
+				break;
+			case ba:
+				block_align = op->a;
+				block_width = op->b;
 				break;
 
-			j=0; t=-1; tval=NULL;
-			next_pos = get_token(linep, &t, &tval);
-			linep += next_pos;
+			case region:
+				/* nothing carries over from the region before, an
+				 * unclosed clickable area ends with it */
+				for(i = sens_areas_cnt - 1; lnr == -1 && i >= 0; i--)
+					if(!sens_areas[i].active) {
+						sens_areas[i].end_x = lim;
+						sens_areas[i].end_y = max_y;
+						sens_areas[i].active = 1;
+					}
+				lastfg = dzen.norm[ColFG];
+				lastbg = dzen.norm[ColBG];
+				pen_fg = reverse ? lastbg : lastfg;
+#ifdef DZEN_XFT
+				xftcs = dzen.fg;
+				xftcs_bg = dzen.bg;
+#endif
+				nobg = 0;
+				cur_fnt = &dzen.font;
+#ifndef DZEN_XFT
+				if(!cur_fnt->set) {
+					gcv.font = cur_fnt->xfont->fid;
+					XChangeGC(dzen.dpy, dzen.tgc, GCFont, &gcv);
+				}
+#endif
+				fnh = HASH_INIT;
+				pos_is_fixed = set_posy = 0;
+				py = (dzen.line_height - cur_fnt->height) / 2;
+				rgx = px = MIN(op->a, dzen.w);
+				lim = op->b < 0 ? dzen.w : MIN(op->a + op->b, dzen.w);
+				break;
+		}
 
-			/* ^^ escapes */
-			if(next_pos == 0)
-				lbuf[j++] = *linep++;
+		/* check if text is longer than window's width */
+		j = strlen(text);
+		tw = textnw(cur_fnt, text, j);
+		maxw = block_align != -1 ? MIN(lim - px, block_width) : lim - px;
+		maxw = MAX(maxw, 0);
+		if(tw > maxw)
+			j = textfit(cur_fnt, text, j, maxw, &tw);
+		
+		opx = px;
+
+		if(block_align != -1 && OUTSIDE(px, block_width))
+			block_width = MAX(0, lim - px);
+		/* draw background for block */
+		if(block_align!=-1 && !nobg) {
+			setcolor(px, rectw, lastbg, lastbg, 0, nobg);
+			fill_rect(px, 0, block_width, dzen.line_height);
+			EXTENT(px, block_width);
 		}
-		else
-			lbuf[j++] = *linep;
 
-		linep++;
-	}
+		if(block_align==ALIGNRIGHT)
+			px += (block_width - tw);
+		else if(block_align==ALIGNCENTER)
+			px += (block_width/2) - (tw/2);
 
-	if(!nodraw) {
-		/* expand/shrink dynamically */
-		if(dzen.title_win.expand && lnr == -1){
-			i = px;
-			switch(dzen.title_win.expand) {
-				case left:
-					/* grow left end */
-					otx = dzen.title_win.x_right_corner - i > dzen.title_win.x ?
-						dzen.title_win.x_right_corner - i : dzen.title_win.x;
-					XMoveResizeWindow(dzen.dpy, dzen.title_win.win, otx, dzen.title_win.y, px, dzen.line_height);
-					break;
-				case right:
-					XResizeWindow(dzen.dpy, dzen.title_win.win, px, dzen.line_height);
-					break;
-			}
+		if(!nobg)
+			setcolor(px, tw, lastfg, lastbg, reverse, nobg);
+		
+		if(j)
+			pen_server(px, px + tw);
+#ifndef DZEN_XFT
+		if(cur_fnt->set)
+			XmbDrawString(dzen.dpy, pm, cur_fnt->set,
+					dzen.tgc, px, py + cur_fnt->ascent, text, j);
+		else
+			XDrawString(dzen.dpy, pm, dzen.tgc, px, py+cur_fnt->ascent, text, j);
+#else
+		XftDrawStringUtf8(xftd, getxftcolor(reverse ? xftcs_bg : xftcs),
+				cur_fnt->xftfont, px, py + cur_fnt->ascent, (const FcChar8 *)text, j);
+#endif
 
+		max_y = MAX(max_y, py+cur_fnt->height);
+		EXTENT(px, tw);
+
+		if(block_align==-1) {
+			if(!pos_is_fixed || k == dl->nops-1)
+				px += tw;
 		} else {
-			if(align == ALIGNLEFT)
-				xorig = 0;
-			if(align == ALIGNCENTER) {
-				xorig = (lnr != -1) ?
-					(dzen.slave_win.width - px)/2 :
-					(dzen.title_win.width - px)/2;
-			}
-			else if(align == ALIGNRIGHT) {
-				xorig = (lnr != -1) ?
-					(dzen.slave_win.width - px) :
-					(dzen.title_win.width - px);
-			}
+			if(pos_is_fixed)
+				px = opx;
+			else
+				px = opx+block_width;
 		}
 
+		block_align=block_width=-1;
+
+		if(lnr == -1)
+			add_seg(sig, sx0, sx1);
+	}
+
+	/* expand/shrink dynamically */
+	if(dzen.title_win.expand && lnr == -1){
+		i = px;
+		switch(dzen.title_win.expand) {
+			case left:
+				/* grow left end */
+				otx = dzen.title_win.x_right_corner - i > dzen.title_win.x ?
+					dzen.title_win.x_right_corner - i : dzen.title_win.x;
+				XMoveResizeWindow(dzen.dpy, dzen.title_win.win, otx, dzen.title_win.y, px, dzen.line_height);
+				break;
+			case right:
+				XResizeWindow(dzen.dpy, dzen.title_win.win, px, dzen.line_height);
+				break;
+		}
 
-		if(lnr != -1) {
-			XCopyArea(dzen.dpy, pm, dzen.slave_win.drawable[lnr], dzen.gc,
-					0, 0, dzen.w, dzen.line_height, xorig, 0);
+	} else {
+		if(align == ALIGNCENTER) {
+			xo = (lnr != -1) ?
+				(dzen.slave_win.width - px)/2 :
+				(dzen.title_win.width - px)/2;
 		}
-		else {
+		else if(align == ALIGNRIGHT) {
+			xo = (lnr != -1) ?
+				(dzen.slave_win.width - px) :
+				(dzen.title_win.width - px);
+		}
+	}
+
+	pen_end();
+
+	if(lnr != -1) {
+		/* clipped to the line, the pixmap holds the others as well */
+		slot_rect(lnr, &slot);
+		i = xo < 0 ? -xo : 0;
+		xo = xo < 0 ? 0 : xo;
+		if(MIN(dzen.w - i, slot.width - xo) > 0)
+			XCopyArea(dzen.dpy, pm, dzen.slave_win.pm, dzen.gc, i, 0,
+					MIN(dzen.w - i, slot.width - xo), dzen.line_height,
+					slot.x + xo, slot.y);
+	}
+	else {
+		/* clickable areas are relative to the title line */
+		xorig = xo;
+		damage_title(xo, dzen.title_win.expand);
+		if(ndamage == 1 && damage[0].x0 == 0 && damage[0].x1 == dzen.title_win.width) {
+			XFillRectangle(dzen.dpy, dzen.title_win.drawable, dzen.rgc, 0, 0, dzen.w, dzen.h);
 			XCopyArea(dzen.dpy, pm, dzen.title_win.drawable, dzen.gc,
-					0, 0, dzen.w, dzen.line_height, xorig, 0);
+					0, 0, dzen.w, dzen.line_height, xo, 0);
 		}
-		XFreePixmap(dzen.dpy, pm);
+		else
+			for(i=0; i < ndamage; i++)
+				XCopyArea(dzen.dpy, pm, dzen.title_win.drawable, dzen.gc,
+						damage[i].x0 - xo, 0, damage[i].x1 - damage[i].x0, dzen.line_height,
+						damage[i].x0, 0);
+	}
+}
+
+/* the text of a line without any in-text commands */
+static char *
+line_text(Dlist *dl) {
+	char *rbuf;
+	size_t len = 0, n;
+	int k;
+
+	rbuf = emalloc(MAX_LINE_LEN);
+	rbuf[0] = '\0';
+	for(k=0; k < dl->nops; k++) {
+		if(dl->ops[k].text == -1)
+			continue;
+		n = strlen(dl->str + dl->ops[k].text);
+		if(len + n >= MAX_LINE_LEN)
+			n = MAX_LINE_LEN - 1 - len;
+		memcpy(rbuf + len, dl->str + dl->ops[k].text, n);
+		len += n;
+	}
+	rbuf[len] = '\0';
+
+	return rbuf;
+}
+
+/* bytes dl_copy() needs for a copy of src */
+size_t
+dl_size(const Dlist *src) {
+	return sizeof(Dlist) + src->nops * sizeof(Dop) + src->slen;
+}
+
+/* copy of a display list in the dl_size() bytes at mem */
+Dlist *
+dl_copy(void *mem, const Dlist *src) {
+	Dlist *dl = mem;
+
+	dl->ops = (Dop *)(dl + 1);
+	dl->nops = dl->maxops = src->nops;
+	dl->str = (char *)(dl->ops + src->nops);
+	dl->slen = dl->smax = src->slen;
+	memcpy(dl->ops, src->ops, src->nops * sizeof(Dop));
+	memcpy(dl->str, src->str, src->slen);
+
+	return dl;
+}
+
+/*
+ * Compiles a line into a single piece of memory from alloc(), the
+ * display list followed by a copy of the text, returned in *copy.
+ */
+Dlist *
+compile_text(const char *text, void *(*alloc)(size_t), char **copy) {
+	static Dlist dl;
+	size_t dlen, tlen = strlen(text) + 1;
+	char *p;
+
+	compile_line(&dl, text);
+	dlen = dl_size(&dl);
+	p = alloc(dlen + tlen);
+	*copy = memcpy(p + dlen, text, tlen);
+	return dl_copy(p, &dl);
+}
+
+/*
+ * Slave window lines are compiled once when they are added to the
+ * buffer, see drawbody(), and drawn from their display list from then on.
+ * The display list and the text of a line share one piece of the line
+ * arena, see arena.c.
+ */
+void
+buffer_line(int slot, const char *text) {
+	dzen.slave_win.tdl[slot] = compile_text(text, arena_alloc, &dzen.slave_win.tbuf[slot]);
+}
 
-		/* reset font to default */
-		if(font_was_set)
-			setfont(dzen.fnt ? dzen.fnt : FONT);
+/*
+ * Slave window lines (lnr != -1) are always taken from the compiled
+ * buffer, the title line is compiled on every call.
+ */
+char *
+parse_line(const char *line, int lnr, int align, int reverse, int nodraw) {
+	static Dlist dl;
+	Dlist *sdl;
+	int l = dzen.slave_win.first_line_vis + lnr;
 
-#ifdef DZEN_XPM
-		if(free_xpm_attrib) {
-			XFreeColors(dzen.dpy, xpma.colormap, xpma.pixels, xpma.npixels, xpma.depth);
-			XpmFreeAttributes(&xpma);
+	/* parse line and return the text without control commands */
+	if(nodraw) {
+		if(!(sdl = buf_line(l, NULL))) {
+			dl_reset(&dl);
+			return line_text(&dl);
 		}
-#endif
+		return line_text(sdl);
+	}
 
-#ifdef DZEN_XFT
-		XftDrawDestroy(xftd);
-#endif
+	if(lnr != -1) {
+		/* nothing to draw past the end of the slave window buffer */
+		if((sdl = buf_line(l, NULL)))
+			render_line(sdl, lnr, align, reverse);
+		return NULL;
+	}
+
+	compile_line(&dl, line);
+	render_line(&dl, lnr, align, reverse);
+
+	return NULL;
+}
+
+/*
+ * Binary display list protocol (-proto binary).
+ *
+ * A frame is a sequence of ops, each a one byte opcode followed by its
+ * arguments. Numbers are big-endian, coordinates are signed 16 bit and
+ * colors 0xRRGGBB with 0xffffffff selecting the default color:
+ *
+ *   'T' len:u16 bytes      text
+ *   'F' rgb:u32            ^fg()
+ *   'B' rgb:u32            ^bg()
+ *   'R' w h x y            ^r()
+ *   'r' w h x y            ^ro()
+ *   'C' d a                ^c(), full circle if a is 0
+ *   'c' d a                ^co()
+ *   'P' x y                ^p(), x only if y is 0
+ *   'A' x y                ^pa()
+ *   'I' len:u16 path       ^i()
+ *
+ * Text is attached to the op before it, as in the text protocol.
+ * Returns -1 on a truncated frame or unknown opcode, dl then holds the
+ * ops decoded up to that point and is not to be drawn.
+ */
+
+static int
+get16(const unsigned char *p) {
+	return (short)(p[0] << 8 | p[1]);
+}
+
+static unsigned long
+get32(const unsigned char *p) {
+	return (unsigned long)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int
+decode_frame(Dlist *dl, const unsigned char *p, size_t len) {
+	const unsigned char *end = p + len;
+	unsigned long rgb;
+	char name[8];
+	size_t n;
+	Dop *op;
+	int c;
+
+	dl_reset(dl);
+	dl_op(dl, -1);
+
+	while(p < end) {
+		c = *p++;
+		switch(c) {
+			case 'T':
+			case 'I':
+				if(end - p < 2 || (size_t)(end - p - 2) < (n = get16(p) & 0xffff))
+					return -1;
+				if(c == 'I') {
+					op = dl_op(dl, icon);
+					op->arg = dl_str(dl, (const char *)p+2, n);
+				}
+				/* a second text run starts an op of its own */
+				else if(dl->ops[dl->nops-1].text != -1)
+					dl_op(dl, -1)->text = dl_str(dl, (const char *)p+2, n);
+				else
+					dl->ops[dl->nops-1].text = dl_str(dl, (const char *)p+2, n);
+				p += 2 + n;
+				break;
+			case 'F':
+			case 'B':
+				if(end - p < 4)
+					return -1;
+				op = dl_op(dl, c == 'F' ? fg : bg);
+				if((rgb = get32(p)) == 0xffffffffUL)
+					op->col = dzen.norm[c == 'F' ? ColFG : ColBG];
+				else {
+					snprintf(name, sizeof name, "#%06lx", rgb & 0xffffff);
+					op->col = (unsigned)getcolor(name);
+					op->arg = dl_str(dl, name, 7);
+				}
+				p += 4;
+				break;
+			case 'R':
+			case 'r':
+				if(end - p < 8)
+					return -1;
+				op = dl_op(dl, c == 'R' ? rect : recto);
+				op->a = get16(p);
+				op->b = get16(p+2);
+				op->c = get16(p+4);
+				op->d = get16(p+6);
+				op->r = 4;
+				p += 8;
+				break;
+			case 'C':
+			case 'c':
+			case 'P':
+			case 'A':
+				if(end - p < 4)
+					return -1;
+				op = dl_op(dl, c == 'C' ? circle : c == 'c' ? circleo : c == 'P' ? pos : abspos);
+				op->a = get16(p);
+				op->b = get16(p+2);
+				if(c == 'C' || c == 'c')
+					op->r = op->b ? 2 : 1;
+				else
+					op->r = op->b ? 3 : 1;
+				p += 4;
+				break;
+			default:
+				return -1;
+		}
 	}
 
-	return nodraw ? rbuf : NULL;
+	return 0;
 }
 
 int
@@ -988,15 +2089,212 @@ parse_non_drawing_commands(char * text) {
 }
 
 
+/* latest-wins title updates, see title_batch_begin() */
+static Bool title_batch = False;
+static const char *title_pending = NULL;
+/* title line kept for the next frame (-fps) and for -chan */
+static char title_text[MAX_LINE_LEN];
+static Bool title_queued = False;
+/* latest binary frame, drawn instead of title_text */
+static Dlist title_frame;
+static unsigned long title_frame_hash;
+static Bool title_isframe = False;
+/* the title line in the drawable and the clickable areas it produced */
+static unsigned long title_hash, title_areas_hash;
+static Bool title_drawn = False;
+
+static unsigned long
+areas_hash(void) {
+	return hashmem(sens_areas, sens_areas_cnt * sizeof(click_a),
+			hashmem(&sens_areas_cnt, sizeof sens_areas_cnt, HASH_INIT));
+}
+
+/*
+ * Render a title line into the title drawable and copy the damaged
+ * parts to the window. Returns 0 without touching anything if the line
+ * is the one already drawn and the clickable areas are still the ones
+ * it produced.
+ */
+static int
+render_header(const char *text) {
+	const char *line = text;
+	unsigned long h;
+	int i;
+
+	dzen.w = dzen.title_win.width;
+	dzen.h = dzen.line_height;
+
+	if(title_isframe)
+		h = title_frame_hash;
+	else {
+		if(nchannels)
+			text = chan_compose(text);
+		h = hashmem(text, strlen(text), HASH_INIT);
+	}
+	if(title_drawn && h == title_hash && areas_hash() == title_areas_hash) {
+		dzen.title_win.nskipped++;
+		return 0;
+	}
+
+	if(title_isframe)
+		render_line(&title_frame, -1, dzen.title_win.alignment, 0);
+	else
+		parse_line(text, -1, dzen.title_win.alignment, 0, 0);
+
+	for(i=0; i < ndamage; i++)
+		XCopyArea(dzen.dpy, dzen.title_win.drawable, dzen.title_win.win, dzen.gc,
+				damage[i].x0, 0, damage[i].x1 - damage[i].x0, dzen.line_height,
+				damage[i].x0, 0);
+
+	title_hash = h;
+	title_areas_hash = areas_hash();
+	title_drawn = True;
+
+	/* kept to be drawn again by redraw_icons() */
+	if(title_waits && !title_isframe && line != title_text)
+		snprintf(title_text, sizeof title_text, "%s", line);
+	return 1;
+}
+
+/* keep only the newest title line while a batch is open */
+static int
+defer_header(const char *text) {
+	if(!title_batch)
+		return 0;
+
+	if(title_pending)
+		dzen.title_win.ncoalesced++;
+	title_pending = text;
+	return 1;
+}
+
+/*
+ * With -coalesce all title lines handed to drawheader() between
+ * title_batch_begin() and title_batch_end() are only remembered, and
+ * the newest one is rendered when the batch ends. Non-drawing commands
+ * still take effect immediately and in order. The text must stay valid
+ * until title_batch_end().
+ *
+ * With -fps the newest line is not rendered but kept for the next
+ * frame, see title_commit(). With -chan it is kept as well, as it has
+ * to be drawn again whenever a channel changes.
+ */
+void
+title_batch_begin(void) {
+	title_batch = dzen.coalesce || dzen.fps || nchannels;
+	title_pending = NULL;
+}
+
+void
+title_batch_end(void) {
+	title_batch = False;
+	if(!title_pending)
+		return;
+
+	if(dzen.fps || nchannels) {
+		if(title_queued)
+			dzen.title_win.ncoalesced++;
+		strcpy(title_text, title_pending);
+		title_queued = True;
+		title_refresh();
+	}
+	else
+		render_header(title_pending);
+	title_pending = NULL;
+}
+
+/* redraw the kept title line, with -fps on the next frame */
+void
+title_refresh(void) {
+	dzen.title_win.dirty = True;
+	if(!dzen.fps)
+		title_commit();
+}
+
+void
+title_commit(void) {
+	if(!dzen.title_win.dirty)
+		return;
+
+	dzen.title_win.dirty = False;
+	title_queued = False;
+	render_header(title_text);
+}
+
+/* draw a frame of the binary protocol into the title window */
+void
+drawframe(const unsigned char *frame, size_t len) {
+	static Dlist next;
+	unsigned long h = hashmem(frame, len, HASH_INIT);
+	Dlist t;
+
+	/* not even decoded if it is the frame already drawn or queued */
+	if(title_isframe && h == title_frame_hash) {
+		dzen.title_win.nskipped++;
+		return;
+	}
+	/* a malformed frame leaves the one shown or queued alone */
+	if(decode_frame(&next, frame, len) == -1) {
+		fprintf(stderr, "dzen: malformed frame dropped\n");
+		return;
+	}
+	if(title_isframe && dzen.title_win.dirty)
+		dzen.title_win.ncoalesced++;
+	t = title_frame;
+	title_frame = next;
+	next = t;
+	title_frame_hash = h;
+	title_isframe = True;
+	title_refresh();
+}
+
+static Bool
+shows_icon(Dlist *dl, char **names, int n) {
+	int i, j;
+
+	for(i=0; dl && i < dl->nops; i++)
+		if(dl->ops[i].type == icon && dl->ops[i].arg != -1)
+			for(j=0; j < n; j++)
+				if(!strcmp(dl->str + dl->ops[i].arg, names[j]))
+					return True;
+	return False;
+}
+
+/*
+ * Called when the icon files in names have been read, draws the title
+ * and the visible slave lines again that show a placeholder for them.
+ */
+void
+redraw_icons(char **names, int n) {
+	SWIN *s = &dzen.slave_win;
+	int i, l, redraw = 0;
+
+	if(title_waits) {
+		/* the icon may take the placeholder's place and size exactly */
+		segs_valid = False;
+		title_drawn = False;
+		title_refresh();
+	}
+
+	for(i=0; i < s->max_lines; i++) {
+		l = s->first_line_vis + i;
+		if(s->dline[i] == l && shows_icon(buf_line(l, NULL), names, n)) {
+			s->dline[i] = -1;
+			redraw = 1;
+		}
+	}
+	if(redraw)
+		x_draw_body();
+}
+
 void
 drawheader(const char * text) {
 	if(parse_non_drawing_commands((char *)text)) {
-		if (text){
-			dzen.w = dzen.title_win.width;
-			dzen.h = dzen.line_height;
-
-			XFillRectangle(dzen.dpy, dzen.title_win.drawable, dzen.rgc, 0, 0, dzen.w, dzen.h);
-			parse_line(text, -1, dzen.title_win.alignment, 0, 0);
+		/* without text only the window is refreshed, see x_redraw() */
+		if(text) {
+			if(!defer_header(text))
+				render_header(text);
+			return;
 		}
 	} else {
 		dzen.slave_win.tcnt = -1;
@@ -1010,7 +2308,7 @@ drawheader(const char * text) {
 void
 drawbody(char * text) {
 	char *ec;
-	int i, write_buffer=1;
+	int write_buffer=1;
 
 	if(dzen.slave_win.tcnt == -1) {
 		dzen.slave_win.tcnt = 0;
@@ -1018,34 +2316,36 @@ drawbody(char * text) {
 		return;
 	}
 
-	if((ec = strstr(text, "^tw()")) && (*(ec-1) != '^')) {
-		dzen.w = dzen.title_win.width;
-		dzen.h = dzen.line_height;
-
-		XFillRectangle(dzen.dpy, dzen.title_win.drawable, dzen.rgc, 0, 0, dzen.w, dzen.h);
-		parse_line(ec+5, -1, dzen.title_win.alignment, 0, 0);
-		XCopyArea(dzen.dpy, dzen.title_win.drawable, dzen.title_win.win,
-				dzen.gc, 0, 0, dzen.w, dzen.h, 0, 0);
+	if((ec = strstr(text, "^tw()")) && (ec == text || *(ec-1) != '^')) {
+		if(defer_header(ec+5))
+			return;
+		render_header(ec+5);
 		return;
 	}
 
-	if(dzen.slave_win.tcnt == dzen.slave_win.tsize)
-		free_buffer();
-
 	write_buffer = parse_non_drawing_commands(text);
 
 
 	if(text[0] == '^' && text[1] == 'c' && text[2] == 's') {
 		free_buffer();
 
-		for(i=0; i < dzen.slave_win.max_lines; i++)
-			XFillRectangle(dzen.dpy, dzen.slave_win.drawable[i], dzen.rgc, 0, 0, dzen.slave_win.width, dzen.line_height);
+		if(dzen.slave_win.ishmenu)
+			XFillRectangle(dzen.dpy, dzen.slave_win.pm, dzen.rgc, 0, 0,
+					dzen.title_win.width, dzen.line_height);
+		else
+			XFillRectangle(dzen.dpy, dzen.slave_win.pm, dzen.rgc, 0, 0,
+					dzen.slave_win.width, dzen.slave_win.max_lines * dzen.line_height);
 		x_draw_body();
 		return;
 	}
 
-	if( write_buffer && (dzen.slave_win.tcnt < dzen.slave_win.tsize) ) {
-		dzen.slave_win.tbuf[dzen.slave_win.tcnt] = estrdup(text);
+	if(write_buffer) {
+		/* a full buffer makes room by dropping its oldest line */
+		if(dzen.slave_win.tcnt - dzen.slave_win.hoff == dzen.slave_win.tsize)
+			evict_line();
+		if(dzen.hist_file)
+			hist_append(text);
+		buffer_line(SLINE(dzen.slave_win.tcnt), text);
 		dzen.slave_win.tcnt++;
 	}
 }
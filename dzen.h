@@ -13,6 +13,9 @@
 #ifdef DZEN_XFT
 #include <X11/Xft/Xft.h>
 #endif
+#ifdef DZEN_XRENDER
+#include <X11/extensions/Xrender.h>
+#endif
 
 #define FONT		"-*-fixed-*-*-*-*-*-*-*-*-*-*-*-*"
 #define BGCOLOR		"#111111"
@@ -25,8 +28,14 @@
 
 #define MIN_BUF_SIZE   1024
 #define MAX_LINE_LEN   8192
+#define INBUF_SIZE     (4*MAX_LINE_LEN)
 
 #define MAX_CLICKABLE_AREAS 256
+#define MAX_CHANNELS        16
+#define MAX_PRELOAD_FONTS   64
+#define ICON_CACHE_KB       1024
+
+#define HASH_INIT 2166136261UL
 
 #ifndef Button6
 # define Button6 6
@@ -46,6 +55,12 @@ typedef struct Fnt Fnt;
 typedef struct TW TWIN;
 typedef struct SW SWIN;
 typedef struct _Sline Sline;
+typedef struct _Inbuf Inbuf;
+typedef struct _Chan Chan;
+typedef struct _Dop Dop;
+typedef struct _Dlist Dlist;
+typedef struct _Advcache Advcache;
+typedef struct _Icon Icon;
 
 struct Fnt {
 	XFontStruct *xfont;
@@ -55,9 +70,38 @@ struct Fnt {
 	int height;
 #ifdef DZEN_XFT
 	XftFont *xftfont;
-	XGlyphInfo *extents;
 	int width;
 #endif
+	Advcache *adv;
+};
+
+enum { IconXbm, IconXpm, IconArgb, IconPending, IconNone };
+
+/* raw ARGB icons: magic, width and height, then the pixels, see icon.c */
+#define DZI_MAGIC	"DZI1"
+#define DZI_HEADER	12
+
+/* cached ^i() icon, see icon.c */
+struct _Icon {
+	char *name;
+	unsigned long hash;
+	unsigned long bg;		/* XPM: color of transparent pixels */
+	int type;
+	int w, h;
+	Pixmap p;				/* XBM: created on first use */
+	int sx, sy;				/* offset in p, see -icon-preload */
+	Pixmap mask;			/* XPM preloaded: shape, at sx, sy as well */
+	Bool pinned;
+	unsigned char *bits;	/* XBM only */
+	unsigned long *pixels;	/* XPM: allocated colors */
+	int npixels;
+#ifdef DZEN_XRENDER
+	Picture pic;			/* ARGB: p as source for XRenderComposite() */
+#endif
+	unsigned long size;		/* bytes taken on client and server */
+	time_t stamp;			/* last use, IconNone: when reading failed */
+	Icon *next;				/* hash chain */
+	Icon *lprev, *lnext;	/* LRU list */
 };
 
 /* clickable areas */
@@ -75,6 +119,46 @@ extern int sens_areas_cnt;
 extern int xorig;
 
 
+/* line buffered input, see input.c */
+struct _Inbuf {
+	int fd;
+	char buf[INBUF_SIZE+1];
+	size_t start, end;		/* unconsumed data is buf[start..end) */
+	Bool discard;			/* skipping the rest of an overlong line */
+	size_t skip;			/* bytes left of an oversized frame */
+	Bool eof;
+};
+
+/* one in-text command with its resolved arguments and the text after it */
+struct _Dop {
+	int type;				/* command type, -1 for text only */
+	int a, b, c, d;			/* numeric arguments */
+	int r;					/* number of numeric arguments given */
+	unsigned long col;		/* color of ^fg() and ^bg() */
+	int arg;				/* string argument, offset into Dlist.str or -1 */
+	int text;				/* offset into Dlist.str or -1 */
+};
+
+/* display list, a line of input ready to be drawn */
+struct _Dlist {
+	Dop *ops;
+	int nops, maxops;
+	char *str;
+	int slen, smax;
+};
+
+/* input channel, see -chan */
+struct _Chan {
+	char *path;
+	Bool issocket;
+	int lfd;					/* listening socket */
+	int x;						/* left edge in the title window */
+	Inbuf in;					/* in.fd is -1 while a socket has no client */
+	char line[MAX_LINE_LEN];	/* latest complete line */
+};
+extern Chan *channels[MAX_CHANNELS];
+extern int nchannels;
+
 /* title window */
 struct TW {
 	int x, y, width, height;
@@ -86,6 +170,12 @@ struct TW {
 	int expand;
 	int x_right_corner;
 	Bool ishidden;
+
+	/* title lines dropped by -coalesce and -fps */
+	unsigned long ncoalesced;
+	/* title lines not drawn as they were identical to the last one */
+	unsigned long nskipped;
+	Bool dirty;
 };
 
 /* slave window */
@@ -94,13 +184,17 @@ struct SW {
 
 	char *name;
 	Window win;
-	Window *line;
-	Drawable *drawable;
+	Pixmap pm;			/* all lines, line i at slot_rect(i) */
+	int lw;				/* -m h: width of a line but the last */
+	int *dline;			/* buffer line drawn into line i or -1 */
 
-	/* input buffer */
+	/* input buffer, a ring of tsize lines starting at thead */
 	char **tbuf; 
+	Dlist **tdl;		/* tbuf compiled to display lists */
 	int tsize;
 	int tcnt;
+	int thead;
+	int hoff;			/* -history-file: lines before the ring, only on disk */
 	/* line fg colors */
 	unsigned long *tcol;
 
@@ -114,6 +208,7 @@ struct SW {
 	Bool ishmenu;
 	Bool issticky;
 	Bool ismapped;
+	Bool dirty;
 };
 
 struct DZEN {
@@ -139,11 +234,19 @@ struct DZEN {
 	Visual *visual;
 	GC gc, rgc, tgc;
 	Fnt font;
-	Fnt fnpl[64];
+	char *fnpl[MAX_PRELOAD_FONTS];	/* -fn-preload, opened on first use */
 
 	Bool ispersistent;
 	Bool tsupdate;
+	Bool coalesce;
+	Bool binproto;
+	Bool raster;
+	unsigned long icon_cache;	/* -icon-cache, in bytes */
+	const char *icon_pre;		/* -icon-preload */
+	const char *hist_file;		/* -history-file */
+	unsigned long icon_hits, icon_misses;
 	Bool colorize;
+	int fps;
 	unsigned long timeout;
 	long cur_line;
 	int ret_val;
@@ -154,7 +257,12 @@ struct DZEN {
 
 extern Dzen dzen;
 
+/* slot in tbuf and tdl of line l of the slave window buffer, l >= hoff */
+#define SLINE(l) (((l) - dzen.slave_win.hoff + dzen.slave_win.thead) % dzen.slave_win.tsize)
+
 void free_buffer(void);
+void evict_line(void);
+Dlist *buf_line(int l, char **text);	/* line l of the slave window buffer or NULL */
 void x_draw_body(void);
 
 /* draw.c */
@@ -168,13 +276,74 @@ extern char * parse_line(const char * text,
 		int reverse, 
 		int nodraw);
 extern long getcolor(const char *colstr);		/* returns color of colstr */
+extern long newcolor(const char *colstr);		/* same, kept by the caller */
 extern void setfont(const char *fontstr);		/* sets global font */
 extern unsigned int textw(const char *text);	/* returns width of text in px */
+extern unsigned int textnw(Fnt *font, const char *text, unsigned int len);	/* from cached glyph advances */
+extern unsigned int textnw_uncached(Fnt *font, const char *text, unsigned int len);	/* asks the font */
+extern void free_surfaces(void);
+extern void free_fonts(void);
+extern void compile_line(Dlist *dl, const char *line);	/* into dl, reusing its memory */
+extern size_t dl_size(const Dlist *src);
+extern Dlist *dl_copy(void *mem, const Dlist *src);	/* into dl_size(src) bytes at mem */
+extern Dlist *compile_text(const char *text, void *(*alloc)(size_t), char **copy);
+extern void buffer_line(int slot, const char *text);	/* compiles a line into tbuf and tdl */
 extern void drawheader(const char *text);
+extern void title_batch_begin(void);
+extern void title_batch_end(void);
+extern void title_commit(void);
+extern void title_refresh(void);
 extern void drawbody(char *text);
+extern void drawframe(const unsigned char *frame, size_t len);
+extern void redraw_icons(char **names, int n);
+extern void slot_rect(int line, XRectangle *r);
+
+/* arena.c */
+extern void *arena_alloc(size_t n);	/* memory for the newest buffer line */
+extern void arena_drop(void);		/* the oldest line left the buffer */
+extern void arena_clear(void);
+
+/* history.c */
+extern int hist_open(const char *path);	/* returns the number of lines or -1 */
+extern int hist_append(const char *text);	/* -1 if the line is not added */
+extern void hist_flush(void);		/* writes the appended lines */
+extern Bool hist_has(int l);
+extern Dlist *hist_line(int l, char **text);
+extern void hist_clear(void);
+
+/* icon.c */
+extern Icon *icon_get(const char *name, unsigned long bg);	/* returns NULL if unreadable */
+extern void icon_free_all(void);
+extern void icon_preload(const char *spec);
+extern int icon_async_start(void);	/* returns the fd to watch or -1 */
+extern void icon_async_done(void);
+
+/* input.c */
+extern ssize_t inbuf_fill(Inbuf *ib);	/* reads from ib->fd, returns read(2) result */
+extern char *inbuf_line(Inbuf *ib);		/* returns next complete line or NULL */
+extern unsigned char *inbuf_frame(Inbuf *ib, size_t *len);	/* returns next complete frame or NULL */
+extern void chan_add(const char *spec);		/* registers a channel given as [unix:]path[,x] */
+extern void chan_open_all(void);
+extern void chan_close_all(void);
+extern void chan_accept(Chan *c);
+extern int chan_read(Chan *c);				/* returns 1 if the channel line changed */
+extern const char *chan_compose(const char *title);
+
+/* raster.c */
+extern Bool ras_begin(int w, int h);	/* prepares the image for a line, False if there is none */
+extern void ras_free(void);
+extern void ras_event(XEvent *ev);
+extern void ras_fill(int x, int y, int w, int h, unsigned long pixel);
+extern void ras_rect(int x, int y, int w, int h, unsigned long pixel);
+extern void ras_arc(int x, int y, int d, int a1, int a2, int fill, unsigned long pixel);
+extern void ras_bitmap(int x, int y, int w, int h, const unsigned char *data,
+		unsigned long fg, unsigned long bg);
+extern void ras_put(Drawable d, GC gc, int x0, int x1);	/* uploads columns x0 to x1 */
 
 /* util.c */
 extern void *emalloc(unsigned int size);		/* allocates memory, exits on error */
+extern void *erealloc(void *ptr, unsigned int size);	/* reallocates memory, exits on error */
 extern void eprint(const char *errstr, ...);	/* prints errstr and exits with 1 */
 extern char *estrdup(const char *str);			/* duplicates str, exits on allocation error */
 extern void spawn(const char *arg);				/* execute arg */
+extern unsigned long hashmem(const void *data, size_t len, unsigned long h);
@@ -13,6 +13,10 @@ LIBS = -L/usr/lib
 CFLAGS = -Os ${INCS} 
 LDFLAGS = ${LIBS}
 
+# XPM input for dzicon
+#CFLAGS += -DDZEN_XPM
+#XPMLIBS = -lXpm
+
 # compiler and linker
 CC = gcc
 LD = ${CC}
@@ -0,0 +1,181 @@
+/*
+    dzicon - convert XBM and XPM icons to dzen's raw ARGB format
+
+    Copyright (C) 2007 by Robert Manea  <rob dot manea at gmail dot com>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/*
+ * The output, a .dzi file, is "DZI1", width and height as 32 bit
+ * little-endian numbers, then width x height pixels, row by row, each
+ * a 32 bit little-endian word of premultiplied ARGB.
+ */
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<X11/Xlib.h>
+#include<X11/Xutil.h>
+#ifdef DZEN_XPM
+#include<X11/xpm.h>
+#endif
+
+Display *dpy;
+
+/* #RGB to #RRRRGGGGBBBB with an optional alpha first, or "none" */
+int
+parsecolor(const char *s, unsigned long *argb) {
+	unsigned long v[4];
+	char hex[5];
+	XColor xc;
+	int i, n, len;
+
+	if(!strcasecmp(s, "none")) {
+		*argb = 0;
+		return 1;
+	}
+	if(s[0] == '#') {
+		len = strlen(s+1);
+		n = len % 3 == 0 ? 3 : len % 4 == 0 ? 4 : 0;
+		if(!len || !n || len / n > 4)
+			return 0;
+		v[0] = 0xff;
+		for(i=0; i < n; i++) {
+			memcpy(hex, s + 1 + i * len / n, len / n);
+			hex[len / n] = '\0';
+			/* keep the 8 most significant bits */
+			v[i + 4 - n] = strtoul(hex, NULL, 16) * 255 / ((1UL << 4 * len / n) - 1);
+		}
+		*argb = v[0] << 24 | v[1] << 16 | v[2] << 8 | v[3];
+		return 1;
+	}
+
+	/* color names need the server's database */
+	if(!dpy && !(dpy = XOpenDisplay(NULL)))
+		return 0;
+	if(!XParseColor(dpy, DefaultColormap(dpy, DefaultScreen(dpy)), s, &xc))
+		return 0;
+	*argb = 0xffUL << 24 | (xc.red >> 8) << 16 | (xc.green >> 8) << 8 | xc.blue >> 8;
+	return 1;
+}
+
+unsigned long
+premultiply(unsigned long argb) {
+	unsigned long a = argb >> 24;
+
+	return a << 24
+		| ((argb >> 16 & 0xff) * a / 255) << 16
+		| ((argb >> 8 & 0xff) * a / 255) << 8
+		| (argb & 0xff) * a / 255;
+}
+
+void
+put32(FILE *f, unsigned long v) {
+	putc(v & 0xff, f);
+	putc(v >> 8 & 0xff, f);
+	putc(v >> 16 & 0xff, f);
+	putc(v >> 24 & 0xff, f);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned long fg = 0xffffffff, bg = 0, *pixels;
+	unsigned char *bits;
+	unsigned int w, h, x, y;
+	int i, xh, yh;
+	char *in = NULL, *out = NULL;
+	FILE *f;
+#ifdef DZEN_XPM
+	unsigned long *colors;
+	XpmImage xpm;
+#endif
+
+	for(i=1; i < argc; i++) {
+		if(!strcmp(argv[i], "-fg") && i+1 < argc) {
+			if(!parsecolor(argv[++i], &fg)) {
+				fprintf(stderr, "dzicon: bad color '%s'\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if(!strcmp(argv[i], "-bg") && i+1 < argc) {
+			if(!parsecolor(argv[++i], &bg)) {
+				fprintf(stderr, "dzicon: bad color '%s'\n", argv[i]);
+				return EXIT_FAILURE;
+			}
+		}
+		else if(!in)
+			in = argv[i];
+		else
+			out = argv[i];
+	}
+	if(!in || !out) {
+		fprintf(stderr, "usage: %s [-fg color] [-bg color] <in.xbm|in.xpm> <out.dzi>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(XReadBitmapFileData(in, &w, &h, &bits, &xh, &yh) == BitmapSuccess) {
+		pixels = malloc(w * h * sizeof(unsigned long));
+		for(y=0; y < h; y++)
+			for(x=0; x < w; x++)
+				pixels[y*w + x] = bits[y * ((w+7)/8) + x/8] & (1 << x%8) ? fg : bg;
+		XFree(bits);
+	}
+#ifdef DZEN_XPM
+	else if(XpmReadFileToXpmImage(in, &xpm, NULL) == XpmSuccess) {
+		w = xpm.width;
+		h = xpm.height;
+		colors = malloc(xpm.ncolors * sizeof(unsigned long));
+		for(x=0; x < xpm.ncolors; x++)
+			if(!xpm.colorTable[x].c_color
+					|| !parsecolor(xpm.colorTable[x].c_color, &colors[x])) {
+				fprintf(stderr, "dzicon: %s: unknown color '%s'\n", in,
+						xpm.colorTable[x].c_color ? xpm.colorTable[x].c_color : "");
+				return EXIT_FAILURE;
+			}
+		pixels = malloc(w * h * sizeof(unsigned long));
+		for(x=0; x < w * h; x++)
+			pixels[x] = colors[xpm.data[x]];
+		free(colors);
+		XpmFreeXpmImage(&xpm);
+	}
+#endif
+	else {
+		fprintf(stderr, "dzicon: cannot read '%s'\n", in);
+		return EXIT_FAILURE;
+	}
+
+	if(!(f = fopen(out, "wb"))) {
+		perror(out);
+		return EXIT_FAILURE;
+	}
+	fwrite("DZI1", 1, 4, f);
+	put32(f, w);
+	put32(f, h);
+	for(x=0; x < w * h; x++)
+		put32(f, premultiply(pixels[x]));
+	free(pixels);
+	if(fclose(f)) {
+		perror(out);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
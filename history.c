@@ -0,0 +1,327 @@
+/*
+ * (C)opyright 2007-2009 Robert Manea <rob dot manea at gmail dot com>
+ * See LICENSE file for license details.
+ *
+ */
+
+#include "dzen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Slave window history on disk for -history-file.
+ *
+ * Every line of the slave window buffer is appended to the history
+ * file, newline terminated as it came in, and the offset it starts at
+ * to an index next to it (the same name with ".idx"), as a 64 bit
+ * number in host byte order. Only the newest -history lines are kept in
+ * memory, see drawbody(). Older lines are read from the file when they
+ * are scrolled to. Both files are mapped, only the pages of lines that
+ * were looked at take memory, and the lines are compiled into a small
+ * cache of their own.
+ *
+ * New lines are collected and written with one write() to each file per
+ * batch of input, see hist_flush(), or earlier if one of them is about
+ * to leave memory, see hist_has(). If a write fails or the history has
+ * HIST_MAX lines, lines are no longer added to the file and the oldest
+ * lines leave memory the way they do without -history-file.
+ *
+ * Starting with an existing file continues its history. An index that
+ * does not match the file, after a crash between the two writes, is
+ * rebuilt from the file.
+ */
+
+/* line numbers of the buffer stay ints, see evict_line() */
+#define HIST_MAX	(INT_MAX - dzen.slave_win.tsize)
+#define WBUF_SIZE	(8 * MAX_LINE_LEN)
+#define IBUF_SIZE	1024
+
+typedef struct {
+	int l;					/* line number or -1 */
+	Dlist *dl;
+	char *text;
+} Cached;
+
+typedef struct {
+	int fd;
+	char *map;
+	size_t maplen;			/* address space mapped, at least size */
+	size_t size;
+} Seg;
+
+static Seg data = { -1 }, idx = { -1 };
+static int nlines;				/* lines written to the file */
+static Bool full;				/* no more lines are added */
+
+/* lines not written yet */
+static char wbuf[WBUF_SIZE];
+static size_t wlen;
+static uint64_t ibuf[IBUF_SIZE];
+static int npend;
+static Cached *cache;
+static int ncache;
+
+/* makes the first size bytes of the file readable through s->map */
+static int
+seg_map(Seg *s) {
+	size_t len;
+
+	if(s->map && s->size <= s->maplen)
+		return 0;
+	if(s->map)
+		munmap(s->map, s->maplen);
+	/* room to grow, appended data shows up in the mapping */
+	len = s->size * 2 > 16 << 20 ? s->size * 2 : 16 << 20;
+	s->map = mmap(NULL, len, PROT_READ, MAP_SHARED, s->fd, 0);
+	if(s->map == MAP_FAILED) {
+		s->map = NULL;
+		s->maplen = 0;
+		return -1;
+	}
+	s->maplen = len;
+	return 0;
+}
+
+static int
+seg_open(Seg *s, const char *path) {
+	struct stat st;
+
+	if((s->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600)) == -1
+			|| fstat(s->fd, &st) == -1) {
+		perror(path);
+		return -1;
+	}
+	s->size = st.st_size;
+	return 0;
+}
+
+/* a short write is continued, it fails with the reason on the next try */
+static int
+write_all(int fd, const char *buf, size_t len) {
+	ssize_t n;
+
+	while(len) {
+		if((n = write(fd, buf, len)) == -1) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int
+idx_put(const uint64_t *off, int n) {
+	if(write_all(idx.fd, (const char *)off, n * sizeof(uint64_t)) == -1)
+		return -1;
+	idx.size += n * sizeof(uint64_t);
+	return 0;
+}
+
+/* whether the index has exactly the lines of the file */
+static Bool
+idx_valid(void) {
+	const uint64_t *o = (const uint64_t *)idx.map;
+	uint64_t last;
+
+	if(idx.size % sizeof(uint64_t))
+		return False;
+	if(!nlines)
+		return !data.size;
+	last = o[nlines-1];
+	return last < data.size && data.map[data.size-1] == '\n'
+		&& memchr(data.map + last, '\n', data.size - last) == data.map + data.size - 1;
+}
+
+static int
+idx_rebuild(void) {
+	size_t off;
+	int n = 0;
+
+	fprintf(stderr, "dzen: rebuilding the history index\n");
+	/* a line cut short by a crash is ended */
+	if(data.size && data.map[data.size-1] != '\n') {
+		if(write(data.fd, "\n", 1) != 1)
+			return -1;
+		data.size++;
+		if(seg_map(&data) == -1)
+			return -1;
+	}
+	if(ftruncate(idx.fd, 0) == -1)
+		return -1;
+	idx.size = 0;
+	nlines = 0;
+	for(off = 0; off < data.size; off++)
+		if(!off || data.map[off-1] == '\n') {
+			if(nlines == HIST_MAX) {
+				errno = EFBIG;
+				return -1;
+			}
+			ibuf[n++] = off;
+			nlines++;
+			if(n == IBUF_SIZE) {
+				if(idx_put(ibuf, n) == -1)
+					return -1;
+				n = 0;
+			}
+		}
+	if(n && idx_put(ibuf, n) == -1)
+		return -1;
+	return seg_map(&idx);
+}
+
+/* returns the number of lines in the file or -1 */
+int
+hist_open(const char *path) {
+	char *ipath;
+	int i;
+
+	ipath = emalloc(strlen(path) + 5);
+	sprintf(ipath, "%s.idx", path);
+	i = seg_open(&data, path) == -1 || seg_open(&idx, ipath) == -1;
+	free(ipath);
+	if(i || seg_map(&data) == -1 || seg_map(&idx) == -1)
+		return -1;
+
+	if(idx.size / sizeof(uint64_t) > (size_t)HIST_MAX) {
+		fprintf(stderr, "dzen: %s has more than %d lines\n", path, HIST_MAX);
+		return -1;
+	}
+	nlines = idx.size / sizeof(uint64_t);
+	if(!idx_valid() && idx_rebuild() == -1) {
+		perror("dzen: history index");
+		return -1;
+	}
+
+	/* enough for every line of the window */
+	ncache = 2 * dzen.slave_win.max_lines;
+	cache = emalloc(ncache * sizeof(Cached));
+	for(i=0; i < ncache; i++) {
+		cache[i].l = -1;
+		cache[i].dl = NULL;
+	}
+	return nlines;
+}
+
+/* writes the collected lines, the index last, a line without one is noticed */
+void
+hist_flush(void) {
+	off_t off = data.size;
+
+	if(!npend)
+		return;
+	if(write_all(data.fd, wbuf, wlen) == -1) {
+		perror("dzen: history file");
+		goto fail;
+	}
+	data.size += wlen;
+	if(idx_put(ibuf, npend) == -1) {
+		perror("dzen: history index");
+		goto fail;
+	}
+	nlines += npend;
+	wlen = npend = 0;
+	return;
+
+fail:
+	/* the files keep the lines they had */
+	if(ftruncate(data.fd, off) == 0)
+		data.size = off;
+	if(ftruncate(idx.fd, idx.size) == -1)
+		perror("dzen: history index");
+	wlen = npend = 0;
+	full = True;
+}
+
+/* returns -1 if the line is kept in memory only */
+int
+hist_append(const char *text) {
+	size_t len = strlen(text);
+
+	if(full)
+		return -1;
+	if(nlines + npend == HIST_MAX) {
+		fprintf(stderr, "dzen: history file full, new lines are not added\n");
+		full = True;
+		return -1;
+	}
+	if(wlen + len + 1 > WBUF_SIZE || npend == IBUF_SIZE)
+		hist_flush();
+	if(full)
+		return -1;
+	ibuf[npend++] = data.size + wlen;
+	memcpy(wbuf + wlen, text, len);
+	wbuf[wlen + len] = '\n';
+	wlen += len + 1;
+	return 0;
+}
+
+/* whether line l is in the file, a line not written yet is written first */
+Bool
+hist_has(int l) {
+	if(l >= nlines && l < nlines + npend)
+		hist_flush();
+	return l < nlines;
+}
+
+static void *
+cache_alloc(size_t n) {
+	return emalloc(n);
+}
+
+/* line l of the file, compiled */
+Dlist *
+hist_line(int l, char **text) {
+	static char buf[MAX_LINE_LEN];
+	Cached *c;
+	uint64_t off, end;
+
+	if(l < 0 || l >= nlines)
+		return NULL;
+	c = &cache[l % ncache];
+	if(c->l != l) {
+		if(seg_map(&data) == -1 || seg_map(&idx) == -1)
+			return NULL;
+		off = ((const uint64_t *)idx.map)[l];
+		end = l+1 < nlines ? ((const uint64_t *)idx.map)[l+1] : data.size;
+		end = end - off > MAX_LINE_LEN ? off + MAX_LINE_LEN : end;
+		memcpy(buf, data.map + off, end - off - 1);
+		buf[end - off - 1] = '\0';
+
+		free(c->dl);
+		c->dl = compile_text(buf, cache_alloc, &c->text);
+		c->l = l;
+	}
+	if(text)
+		*text = c->text;
+	return c->dl;
+}
+
+/* forgets all lines, see ^cs */
+void
+hist_clear(void) {
+	int i;
+
+	if(ftruncate(data.fd, 0) == -1 || ftruncate(idx.fd, 0) == -1)
+		perror("dzen: history file");
+	data.size = idx.size = 0;
+	nlines = 0;
+	wlen = npend = 0;
+	full = False;
+	for(i=0; i < ncache; i++) {
+		free(cache[i].dl);
+		cache[i].dl = NULL;
+		cache[i].l = -1;
+	}
+}
@@ -0,0 +1,718 @@
+/*
+ * (C)opyright 2007-2009 Robert Manea <rob dot manea at gmail dot com>
+ * See LICENSE file for license details.
+ *
+ */
+
+#include "dzen.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef DZEN_XPM
+#include <X11/xpm.h>
+#endif
+
+/*
+ * Icon cache for ^i().
+ *
+ * XBM and XPM icons are kept by file name in a hash table. XBM icons
+ * keep their bitmap data, the bitmap on the server is only created
+ * when it is first needed. Transparent pixels of XPM icons get the
+ * background color passed to icon_get(), which is part of the key.
+ *
+ * With DZEN_XRENDER icons can also be raw ARGB (.dzi, made by
+ * gadgets/dzicon): DZI_MAGIC, width and height as 32 bit little-endian
+ * numbers, then the rows of pixels as 32 bit little-endian words of
+ * premultiplied ARGB. The file is mapped and its pixels go to a depth
+ * 32 pixmap as they are, to be composited over the line.
+ *
+ * The cache is bounded by the memory its images take on the client
+ * and on the server (-icon-cache), the least recently used icons are
+ * dropped first. An icon larger than the whole cache is kept alone.
+ *
+ * Once the event loop runs, files are read by a worker thread so a
+ * slow file system does not stall the bar. Until an icon is ready
+ * icon_get() returns a placeholder as wide and high as a line, then
+ * the lines showing it are drawn again, see redraw_icons(). The worker
+ * only decodes into memory, all X requests are made by the main
+ * thread. A file that cannot be read is not tried again for
+ * ICON_RETRY seconds.
+ *
+ * Icons given to -icon-preload are read at startup and packed into an
+ * atlas pixmap per type, a bitmap for XBM, one of the screen depth for
+ * XPM and one of depth 32 for ARGB. They are drawn from there at their
+ * offset and never evicted. Preloaded XPM icons keep their transparent
+ * pixels in a mask atlas and are drawn through it, so unlike cached
+ * ones they serve every background color and no file is read while
+ * lines are drawn.
+ */
+
+#define ICON_HASH_SIZE 64
+#define ICON_RETRY 10
+#define ATLAS_WIDTH 1024
+#define DZI_MAX 32767		/* largest width or height of a pixmap */
+
+/* a file to read, the worker fills in everything but ic */
+typedef struct _Job Job;
+struct _Job {
+	const char *name;
+	Icon *ic;				/* the placeholder, main thread only */
+	int type;				/* IconNone if the file cannot be read */
+	unsigned int w, h;
+	unsigned char *bits;	/* XBM */
+#ifdef DZEN_XPM
+	XpmImage xpm;
+#endif
+	unsigned char *map;		/* ARGB: the mapped file */
+	size_t maplen;
+	Job *next;
+};
+
+static Icon *table[ICON_HASH_SIZE];
+static Icon lru;		/* lru.lnext is the most recently used icon */
+static unsigned long cache_used = 0;
+
+static Icon **pinned = NULL;
+static int npinned = 0;
+static Pixmap atlas[3];		/* by icon type */
+static Pixmap atlas_mask;	/* masks of atlas[IconXpm] */
+#ifdef DZEN_XRENDER
+static Picture atlas_pic;	/* of atlas[IconArgb] */
+static GC argb_gc = NULL;	/* for depth 32 pixmaps */
+static volatile unsigned char argb_touch;
+#endif
+
+static pthread_t worker;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static Job *todo = NULL, **todo_tail = &todo, *done = NULL;	/* job_lock */
+static Bool worker_quit = False;	/* job_lock */
+static int done_fd = -1;	/* counts finished jobs, -1 without worker */
+
+static void
+lru_unlink(Icon *ic) {
+	ic->lprev->lnext = ic->lnext;
+	ic->lnext->lprev = ic->lprev;
+}
+
+static void
+lru_push(Icon *ic) {
+	ic->lnext = lru.lnext;
+	ic->lprev = &lru;
+	lru.lnext->lprev = ic;
+	lru.lnext = ic;
+}
+
+static void
+table_add(Icon *ic) {
+	ic->next = table[ic->hash % ICON_HASH_SIZE];
+	table[ic->hash % ICON_HASH_SIZE] = ic;
+}
+
+static void
+table_unlink(Icon *ic) {
+	Icon **pp;
+
+	for(pp = &table[ic->hash % ICON_HASH_SIZE]; *pp != ic; pp = &(*pp)->next)
+		;
+	*pp = ic->next;
+}
+
+static void
+icon_destroy(Icon *ic) {
+#ifdef DZEN_XRENDER
+	if(ic->pic && !ic->pinned)
+		XRenderFreePicture(dzen.dpy, ic->pic);
+#endif
+	if(ic->p && !ic->pinned)
+		XFreePixmap(dzen.dpy, ic->p);
+	if(ic->mask && ic->mask != atlas_mask)
+		XFreePixmap(dzen.dpy, ic->mask);
+	if(ic->bits)
+		XFree(ic->bits);
+	if(ic->npixels)
+		XFreeColors(dzen.dpy, DefaultColormap(dzen.dpy, dzen.screen),
+				ic->pixels, ic->npixels, 0);
+	free(ic->pixels);
+	free(ic->name);
+	free(ic);
+}
+
+static void
+icon_drop(Icon *ic) {
+	table_unlink(ic);
+	lru_unlink(ic);
+	cache_used -= ic->size;
+	icon_destroy(ic);
+}
+
+/*
+ * Makes room for ic and puts it in front of the LRU list. If keep is
+ * set, icons used since then are not dropped: the icons of the lines
+ * just drawn stay, even if they do not all fit, instead of pushing
+ * each other out on every redraw.
+ */
+static void
+cache_add(Icon *ic, time_t keep) {
+	while(lru.lprev != &lru && cache_used + ic->size > dzen.icon_cache
+			&& (!keep || lru.lprev->stamp < keep))
+		icon_drop(lru.lprev);
+	lru_push(ic);
+	cache_used += ic->size;
+}
+
+#ifdef DZEN_XRENDER
+static unsigned int
+le32(const unsigned char *p) {
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+/* maps the file of j if it is a raw ARGB icon */
+static Bool
+argb_map(Job *j) {
+	struct stat st;
+	unsigned char *m;
+	size_t i, page = getpagesize();
+	int fd;
+
+	if((fd = open(j->name, O_RDONLY)) == -1)
+		return False;
+	m = fstat(fd, &st) || st.st_size < DZI_HEADER ? MAP_FAILED
+		: mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED)
+		return False;
+
+	j->w = le32(m + 4);
+	j->h = le32(m + 8);
+	if(memcmp(m, DZI_MAGIC, 4) || !j->w || !j->h || j->w > DZI_MAX || j->h > DZI_MAX
+			|| DZI_HEADER + (size_t)j->w * j->h * 4 > (size_t)st.st_size) {
+		munmap(m, st.st_size);
+		return False;
+	}
+	/* page the pixels in here rather than in the main thread */
+	for(i=0; i < (size_t)st.st_size; i += page)
+		argb_touch = m[i];
+
+	j->type = IconArgb;
+	j->map = m;
+	j->maplen = st.st_size;
+	return True;
+}
+
+/* the pixels already are what a depth 32 ZPixmap holds */
+static Bool
+argb_upload(Icon *ic, Job *j) {
+	XRenderPictFormat *fmt;
+	XImage *im;
+	int evbase, errbase;
+
+	if(!XRenderQueryExtension(dzen.dpy, &evbase, &errbase)
+			|| !(fmt = XRenderFindStandardFormat(dzen.dpy, PictStandardARGB32)))
+		return False;
+	im = XCreateImage(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen), 32, ZPixmap, 0,
+			(char *)j->map + DZI_HEADER, ic->w, ic->h, 32, ic->w * 4);
+	if(!im)
+		return False;
+	im->byte_order = LSBFirst;
+
+	ic->p = XCreatePixmap(dzen.dpy, RootWindow(dzen.dpy, dzen.screen), ic->w, ic->h, 32);
+	if(!argb_gc)
+		argb_gc = XCreateGC(dzen.dpy, ic->p, 0, NULL);
+	XPutImage(dzen.dpy, ic->p, argb_gc, im, 0, 0, 0, 0, ic->w, ic->h);
+	im->data = NULL;
+	XDestroyImage(im);
+
+	ic->pic = XRenderCreatePicture(dzen.dpy, ic->p, fmt, 0, NULL);
+	ic->size = ic->w * ic->h * 4;
+	return True;
+}
+#endif
+
+/* reads the file of j into memory, called by the worker */
+static void
+icon_decode(Job *j) {
+	int xh, yh;
+
+#ifdef DZEN_XRENDER
+	if(argb_map(j))
+		return;
+#endif
+	if(XReadBitmapFileData(j->name, &j->w, &j->h, &j->bits, &xh, &yh) == BitmapSuccess) {
+		j->type = IconXbm;
+		return;
+	}
+#ifdef DZEN_XPM
+	if(XpmReadFileToXpmImage((char *)j->name, &j->xpm, NULL) == XpmSuccess) {
+		j->type = IconXpm;
+		j->w = j->xpm.width;
+		j->h = j->xpm.height;
+		return;
+	}
+#endif
+	j->type = IconNone;
+}
+
+/* makes ic out of a decoded file, returns False if it cannot be drawn */
+static Bool
+icon_upload(Icon *ic, Job *j) {
+#ifdef DZEN_XPM
+	XpmAttributes xpma;
+	XpmColorSymbol xpms;
+	int depth = DefaultDepth(dzen.dpy, dzen.screen), r;
+#endif
+
+	ic->w = j->w;
+	ic->h = j->h;
+	if(j->type == IconXbm) {
+		ic->type = IconXbm;
+		ic->bits = j->bits;
+		j->bits = NULL;
+		/* the data here and the bitmap on the server */
+		ic->size = 2 * ((ic->w + 7) / 8) * ic->h;
+		return True;
+	}
+#ifdef DZEN_XRENDER
+	if(j->type == IconArgb) {
+		ic->type = argb_upload(ic, j) ? IconArgb : IconNone;
+		munmap(j->map, j->maplen);
+		j->map = NULL;
+		j->type = IconNone;
+		if(ic->type == IconArgb)
+			return True;
+	}
+#endif
+#ifdef DZEN_XPM
+	if(j->type == IconXpm) {
+		xpms.name = NULL;
+		xpms.value = (char *)"none";
+		xpms.pixel = ic->bg;
+
+		xpma.colormap = DefaultColormap(dzen.dpy, dzen.screen);
+		xpma.depth = depth;
+		xpma.visual = DefaultVisual(dzen.dpy, dzen.screen);
+		xpma.colorsymbols = &xpms;
+		xpma.numsymbols = 1;
+		xpma.valuemask = XpmColormap|XpmDepth|XpmVisual|XpmColorSymbols|XpmReturnPixels;
+
+		/* preloaded icons are drawn through their shape, see draw_icon() */
+		r = XpmCreatePixmapFromXpmImage(dzen.dpy, RootWindow(dzen.dpy, dzen.screen),
+				&j->xpm, &ic->p, ic->pinned ? &ic->mask : NULL, &xpma);
+		XpmFreeXpmImage(&j->xpm);
+		j->type = IconNone;
+		if(r == XpmSuccess) {
+			ic->type = IconXpm;
+			ic->size = ic->w * ic->h * (depth > 16 ? 4 : (depth + 7) / 8);
+			/* colors stay allocated as long as the pixmap is cached */
+			if(xpma.npixels) {
+				ic->pixels = emalloc(xpma.npixels * sizeof(unsigned long));
+				memcpy(ic->pixels, xpma.pixels, xpma.npixels * sizeof(unsigned long));
+				ic->npixels = xpma.npixels;
+			}
+			XpmFreeAttributes(&xpma);
+			return True;
+		}
+	}
+#endif
+	ic->type = IconNone;
+	ic->w = ic->h = 0;
+	return False;
+}
+
+/* frees what the worker decoded but nobody uploaded */
+static void
+job_free(Job *j) {
+	if(j->bits)
+		XFree(j->bits);
+	if(j->map)
+		munmap(j->map, j->maplen);
+#ifdef DZEN_XPM
+	if(j->type == IconXpm)
+		XpmFreeXpmImage(&j->xpm);
+#endif
+	free(j);
+}
+
+static Icon *
+icon_new(const char *name, unsigned long hash, unsigned long bg) {
+	Icon *ic = emalloc(sizeof(Icon));
+
+	memset(ic, 0, sizeof(Icon));
+	ic->name = estrdup(name);
+	ic->hash = hash;
+	ic->bg = bg;
+	return ic;
+}
+
+static Icon *
+icon_find(const char *name, unsigned long hash, unsigned long bg) {
+	Icon *ic;
+
+	for(ic = table[hash % ICON_HASH_SIZE]; ic; ic = ic->next)
+		if(ic->hash == hash && !strcmp(ic->name, name)
+				&& (ic->type == IconXbm || ic->type == IconArgb || ic->pinned || ic->bg == bg))
+			return ic;
+	return NULL;
+}
+
+static void *
+icon_worker(void *arg) {
+	uint64_t one = 1;
+	Job *j;
+
+	pthread_mutex_lock(&job_lock);
+	for(;;) {
+		while(!todo && !worker_quit)
+			pthread_cond_wait(&job_cond, &job_lock);
+		if(worker_quit)
+			break;
+		j = todo;
+		if(!(todo = j->next))
+			todo_tail = &todo;
+		pthread_mutex_unlock(&job_lock);
+
+		icon_decode(j);
+
+		pthread_mutex_lock(&job_lock);
+		j->next = done;
+		done = j;
+		write(done_fd, &one, sizeof one);
+	}
+	pthread_mutex_unlock(&job_lock);
+	return NULL;
+}
+
+/* hands the file of the placeholder ic to the worker */
+static void
+icon_queue(Icon *ic) {
+	Job *j = emalloc(sizeof(Job));
+
+	memset(j, 0, sizeof(Job));
+	j->name = ic->name;
+	j->ic = ic;
+	ic->type = IconPending;
+	ic->w = ic->h = dzen.line_height;
+
+	pthread_mutex_lock(&job_lock);
+	*todo_tail = j;
+	todo_tail = &j->next;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+}
+
+/*
+ * Returns the icon of file name or NULL if it cannot be read. With the
+ * worker running it may be an IconPending placeholder.
+ */
+Icon *
+icon_get(const char *name, unsigned long bg) {
+	unsigned long hash = hashmem(name, strlen(name), HASH_INIT);
+	Icon *ic;
+	Job j;
+
+	if(!lru.lnext)
+		lru.lnext = lru.lprev = &lru;
+
+	if((ic = icon_find(name, hash, bg))) {
+		if(ic->type == IconPending)
+			return ic;
+		if(ic->type != IconNone) {
+			dzen.icon_hits++;
+			if(!ic->pinned) {
+				ic->stamp = time(NULL);
+				lru_unlink(ic);
+				lru_push(ic);
+			}
+			return ic;
+		}
+		if(time(NULL) - ic->stamp < ICON_RETRY)
+			return NULL;
+		icon_drop(ic);
+	}
+
+	dzen.icon_misses++;
+	ic = icon_new(name, hash, bg);
+	if(done_fd != -1) {
+		icon_queue(ic);
+		table_add(ic);
+		return ic;
+	}
+
+	memset(&j, 0, sizeof j);
+	j.name = name;
+	icon_decode(&j);
+	if(!icon_upload(ic, &j)) {
+		icon_destroy(ic);
+		return NULL;
+	}
+	ic->stamp = time(NULL);
+	table_add(ic);
+	cache_add(ic, 0);
+	return ic;
+}
+
+/* starts the worker, icons are read synchronously until then */
+int
+icon_async_start(void) {
+	if((done_fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK)) == -1)
+		return -1;
+	if(pthread_create(&worker, NULL, icon_worker, NULL)) {
+		close(done_fd);
+		done_fd = -1;
+	}
+	return done_fd;
+}
+
+/* called when done_fd is readable, uploads the icons the worker read */
+void
+icon_async_done(void) {
+	Job *j, *next;
+	Icon *ic;
+	char **names = NULL;
+	uint64_t cnt;
+	time_t now = time(NULL);
+	int i, n = 0;
+
+	read(done_fd, &cnt, sizeof cnt);
+	pthread_mutex_lock(&job_lock);
+	j = done;
+	done = NULL;
+	pthread_mutex_unlock(&job_lock);
+
+	for(; j; j = next) {
+		next = j->next;
+		ic = j->ic;
+		icon_upload(ic, j);
+		/* an unreadable file is remembered, without taking space */
+		ic->stamp = now;
+		cache_add(ic, now);
+		names = erealloc(names, (n + 1) * sizeof(char *));
+		names[n++] = estrdup(ic->name);
+		job_free(j);
+	}
+
+	redraw_icons(names, n);
+	for(i=0; i < n; i++)
+		free(names[i]);
+	free(names);
+}
+
+static void
+async_stop(void) {
+	Job *lists[2], *j, *next;
+	int i;
+
+	if(done_fd == -1)
+		return;
+
+	pthread_mutex_lock(&job_lock);
+	worker_quit = True;
+	pthread_cond_signal(&job_cond);
+	pthread_mutex_unlock(&job_lock);
+	pthread_join(worker, NULL);
+	close(done_fd);
+	done_fd = -1;
+
+	lists[0] = todo;
+	lists[1] = done;
+	for(i=0; i < 2; i++)
+		for(j = lists[i]; j; j = next) {
+			next = j->next;
+			/* the placeholder may come before cached icons in its chain */
+			table_unlink(j->ic);
+			icon_destroy(j->ic);
+			job_free(j);
+		}
+	todo = done = NULL;
+	todo_tail = &todo;
+}
+
+void
+icon_free_all(void) {
+	int i;
+
+	/* placeholders are in the table but only the jobs know them */
+	async_stop();
+	while(lru.lnext && lru.lnext != &lru)
+		icon_drop(lru.lnext);
+
+	for(i=0; i < npinned; i++)
+		icon_destroy(pinned[i]);
+	free(pinned);
+	pinned = NULL;
+	npinned = 0;
+	memset(table, 0, sizeof table);
+#ifdef DZEN_XRENDER
+	if(atlas_pic)
+		XRenderFreePicture(dzen.dpy, atlas_pic);
+	atlas_pic = 0;
+	if(argb_gc)
+		XFreeGC(dzen.dpy, argb_gc);
+	argb_gc = NULL;
+#endif
+	for(i=0; i < 3; i++)
+		if(atlas[i])
+			XFreePixmap(dzen.dpy, atlas[i]);
+	memset(atlas, 0, sizeof atlas);
+	if(atlas_mask)
+		XFreePixmap(dzen.dpy, atlas_mask);
+	atlas_mask = 0;
+}
+
+static int
+by_height(const void *a, const void *b) {
+	return (*(Icon **)b)->h - (*(Icon **)a)->h;
+}
+
+/* packs the icons of one type in rows, highest first, into an atlas */
+static void
+atlas_build(int type) {
+	Icon **icons;
+	Pixmap pm;
+	GC gc, mgc = NULL;
+	int i, n = 0, x = 0, y = 0, rowh = 0, w = ATLAS_WIDTH, aw = 0;
+	int depth = type == IconXbm ? 1 : type == IconArgb ? 32
+		: DefaultDepth(dzen.dpy, dzen.screen);
+
+	icons = emalloc(npinned * sizeof(Icon *));
+	for(i=0; i < npinned; i++)
+		if(pinned[i]->type == type) {
+			icons[n++] = pinned[i];
+			w = pinned[i]->w > w ? pinned[i]->w : w;
+		}
+	if(!n) {
+		free(icons);
+		return;
+	}
+	qsort(icons, n, sizeof(Icon *), by_height);
+
+	for(i=0; i < n; i++) {
+		if(x + icons[i]->w > w) {
+			x = 0;
+			y += rowh;
+			rowh = 0;
+		}
+		icons[i]->sx = x;
+		icons[i]->sy = y;
+		x += icons[i]->w;
+		aw = x > aw ? x : aw;
+		rowh = icons[i]->h > rowh ? icons[i]->h : rowh;
+	}
+
+	atlas[type] = XCreatePixmap(dzen.dpy, RootWindow(dzen.dpy, dzen.screen),
+			aw, y + rowh, depth);
+	gc = XCreateGC(dzen.dpy, atlas[type], 0, NULL);
+	if(type == IconXpm) {
+		/* icons without transparent pixels are opaque all over */
+		atlas_mask = XCreatePixmap(dzen.dpy, RootWindow(dzen.dpy, dzen.screen),
+				aw, y + rowh, 1);
+		mgc = XCreateGC(dzen.dpy, atlas_mask, 0, NULL);
+		XSetForeground(dzen.dpy, mgc, 1);
+		XFillRectangle(dzen.dpy, atlas_mask, mgc, 0, 0, aw, y + rowh);
+	}
+#ifdef DZEN_XRENDER
+	if(type == IconArgb)
+		atlas_pic = XRenderCreatePicture(dzen.dpy, atlas[type],
+				XRenderFindStandardFormat(dzen.dpy, PictStandardARGB32), 0, NULL);
+#endif
+	for(i=0; i < n; i++) {
+		if(type == IconXbm)
+			pm = XCreateBitmapFromData(dzen.dpy, atlas[type], (char *)icons[i]->bits,
+					icons[i]->w, icons[i]->h);
+		else
+			pm = icons[i]->p;
+		XCopyArea(dzen.dpy, pm, atlas[type], gc, 0, 0, icons[i]->w, icons[i]->h,
+				icons[i]->sx, icons[i]->sy);
+		XFreePixmap(dzen.dpy, pm);
+		icons[i]->p = atlas[type];
+		if(type == IconXpm) {
+			if(icons[i]->mask) {
+				XCopyArea(dzen.dpy, icons[i]->mask, atlas_mask, mgc, 0, 0,
+						icons[i]->w, icons[i]->h, icons[i]->sx, icons[i]->sy);
+				XFreePixmap(dzen.dpy, icons[i]->mask);
+			}
+			icons[i]->mask = atlas_mask;
+		}
+#ifdef DZEN_XRENDER
+		if(type == IconArgb) {
+			XRenderFreePicture(dzen.dpy, icons[i]->pic);
+			icons[i]->pic = atlas_pic;
+		}
+#endif
+	}
+	XFreeGC(dzen.dpy, gc);
+	if(mgc)
+		XFreeGC(dzen.dpy, mgc);
+	free(icons);
+}
+
+static void
+preload_one(const char *name) {
+	unsigned long hash = hashmem(name, strlen(name), HASH_INIT);
+	Icon *ic;
+	Job j;
+
+	if(icon_find(name, hash, dzen.norm[ColBG]))
+		return;
+	memset(&j, 0, sizeof j);
+	j.name = name;
+	icon_decode(&j);
+	ic = icon_new(name, hash, dzen.norm[ColBG]);
+	ic->pinned = True;
+	if(!icon_upload(ic, &j)) {
+		icon_destroy(ic);
+		return;
+	}
+	table_add(ic);
+
+	pinned = erealloc(pinned, (npinned + 1) * sizeof(Icon *));
+	pinned[npinned++] = ic;
+}
+
+/*
+ * Reads the icons of -icon-preload, either every file in a directory
+ * or a comma separated list of files, into the atlases.
+ */
+void
+icon_preload(const char *spec) {
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	char *s, *name;
+	size_t len;
+
+	if(!stat(spec, &st) && S_ISDIR(st.st_mode)) {
+		if(!(dir = opendir(spec)))
+			return;
+		len = strlen(spec);
+		while((de = readdir(dir))) {
+			if(de->d_name[0] == '.')
+				continue;
+			name = emalloc(len + strlen(de->d_name) + 2);
+			sprintf(name, "%s%s%s", spec, len && spec[len-1] == '/' ? "" : "/", de->d_name);
+			preload_one(name);
+			free(name);
+		}
+		closedir(dir);
+	}
+	else {
+		s = estrdup(spec);
+		for(name = strtok(s, ","); name; name = strtok(NULL, ","))
+			preload_one(name);
+		free(s);
+	}
+
+	atlas_build(IconXbm);
+	atlas_build(IconXpm);
+	atlas_build(IconArgb);
+}
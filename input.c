@@ -0,0 +1,360 @@
+/*
+ * (C)opyright 2007-2009 Robert Manea <rob dot manea at gmail dot com>
+ * See LICENSE file for license details.
+ *
+ */
+
+#include "dzen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ * Line splitting for input streams.
+ *
+ * Data is read into a fixed buffer and handed out as NUL-terminated
+ * views straight into that buffer, no line is ever copied. Only the
+ * unterminated tail of a read is moved to the front of the buffer, and
+ * only when there is not enough room left behind it for another line.
+ *
+ * Lines longer than MAX_LINE_LEN-1 bytes are cut at the last UTF-8
+ * character boundary that fits, the remainder up to the next newline is
+ * dropped.
+ */
+
+ssize_t
+inbuf_fill(Inbuf *ib) {
+	ssize_t n;
+
+	if(ib->start == ib->end)
+		ib->start = ib->end = 0;
+	else if(INBUF_SIZE - ib->end < MAX_LINE_LEN) {
+		memmove(ib->buf, ib->buf + ib->start, ib->end - ib->start);
+		ib->end  -= ib->start;
+		ib->start = 0;
+	}
+
+	n = read(ib->fd, ib->buf + ib->end, INBUF_SIZE - ib->end);
+	if(n > 0)
+		ib->end += n;
+	else if(n == 0)
+		ib->eof = True;
+
+	return n;
+}
+
+static char *
+cut_line(Inbuf *ib, char *l, size_t skip) {
+	size_t cut = MAX_LINE_LEN - 1;
+
+	/* do not leave a partial multibyte character behind */
+	while(cut && ((unsigned char)l[cut] & 0xc0) == 0x80)
+		cut--;
+	l[cut] = '\0';
+	ib->start += skip;
+
+	return l;
+}
+
+char *
+inbuf_line(Inbuf *ib) {
+	char *l, *nl;
+	size_t len;
+
+	while(ib->start < ib->end) {
+		l   = ib->buf + ib->start;
+		len = ib->end - ib->start;
+		nl  = memchr(l, '\n', len);
+
+		if(ib->discard) {
+			if(!nl) {
+				ib->start = ib->end;
+				return NULL;
+			}
+			ib->start += nl - l + 1;
+			ib->discard = False;
+			continue;
+		}
+
+		if(nl) {
+			if(nl - l >= MAX_LINE_LEN)
+				return cut_line(ib, l, nl - l + 1);
+			*nl = '\0';
+			ib->start += nl - l + 1;
+			return l;
+		}
+
+		if(len >= MAX_LINE_LEN) {
+			ib->discard = True;
+			return cut_line(ib, l, len);
+		}
+
+		/* unterminated last line */
+		if(ib->eof) {
+			l[len] = '\0';
+			ib->start = ib->end;
+			return l;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Framed input for -proto binary.
+ *
+ * Every frame is a 32 bit big-endian length followed by that many bytes
+ * of draw ops, see decode_frame(). Frames are handed out as views into
+ * the buffer like lines are. A frame that can never fit into the buffer
+ * is reported and skipped as it arrives.
+ */
+
+unsigned char *
+inbuf_frame(Inbuf *ib, size_t *len) {
+	unsigned char *p;
+	size_t avail, flen;
+
+	while(ib->start < ib->end) {
+		p = (unsigned char *)ib->buf + ib->start;
+		avail = ib->end - ib->start;
+
+		if(ib->skip) {
+			flen = avail < ib->skip ? avail : ib->skip;
+			ib->skip  -= flen;
+			ib->start += flen;
+			continue;
+		}
+
+		if(avail < 4)
+			break;
+		flen = (size_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		if(flen > INBUF_SIZE - 4) {
+			fprintf(stderr, "dzen: frame of %lu bytes skipped, the limit is %d\n",
+					(unsigned long)flen, INBUF_SIZE - 4);
+			ib->skip = flen;
+			ib->start += 4;
+			continue;
+		}
+		if(avail - 4 < flen)
+			break;
+
+		ib->start += 4 + flen;
+		*len = flen;
+		return p + 4;
+	}
+
+	return NULL;
+}
+
+/*
+ * Input channels (-chan).
+ *
+ * Besides stdin, every channel is a named FIFO or a listening UNIX
+ * socket that feeds one part of the title window, from its x offset on.
+ * Only the latest line of each channel is kept and the title window
+ * shows the stdin title followed by the lines of all channels, see
+ * chan_compose(). The offsets are absolute, the title is always left
+ * aligned with channels.
+ */
+
+Chan *channels[MAX_CHANNELS];
+int nchannels = 0;
+
+static void
+chan_reset(Chan *c, int fd) {
+	c->in.fd = fd;
+	c->in.start = c->in.end = 0;
+	c->in.discard = c->in.eof = False;
+	c->in.skip = 0;
+}
+
+void
+chan_add(const char *spec) {
+	Chan *c;
+	char *comma;
+
+	if(nchannels >= MAX_CHANNELS)
+		eprint("dzen: error, more than %d input channels\n", MAX_CHANNELS);
+
+	c = emalloc(sizeof(Chan));
+	c->lfd = -1;
+	c->x = -1;
+	c->issocket = False;
+	c->line[0] = '\0';
+	chan_reset(c, -1);
+
+	if(!strncmp(spec, "unix:", 5)) {
+		spec += 5;
+		c->issocket = True;
+	}
+	c->path = estrdup(spec);
+	/* only digits make an offset, other commas belong to the path */
+	if((comma = strrchr(c->path, ',')) && comma[1]
+			&& strspn(comma+1, "0123456789") == strlen(comma+1)) {
+		*comma = '\0';
+		c->x = atoi(comma+1);
+	}
+	if(c->x < 0)
+		eprint("dzen: error, input channel '%s' needs an x offset, e.g. '%s,0'\n",
+				c->path, c->path);
+	channels[nchannels++] = c;
+}
+
+static void
+chan_listen(Chan *c) {
+	struct sockaddr_un sa;
+
+	if(strlen(c->path) >= sizeof sa.sun_path)
+		eprint("dzen: error, socket path too long: '%s'\n", c->path);
+
+	memset(&sa, 0, sizeof sa);
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, c->path);
+	unlink(c->path);
+
+	if((c->lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+			|| bind(c->lfd, (struct sockaddr *)&sa, sizeof sa) < 0
+			|| listen(c->lfd, 4) < 0)
+		eprint("dzen: error, cannot listen on '%s': %s\n", c->path, strerror(errno));
+	fcntl(c->lfd, F_SETFD, FD_CLOEXEC);
+}
+
+static void
+chan_open_fifo(Chan *c) {
+	int fd;
+
+	if(mkfifo(c->path, 0600) < 0 && errno != EEXIST)
+		eprint("dzen: error, cannot create fifo '%s': %s\n", c->path, strerror(errno));
+
+	/* opened for writing as well, so there is no EOF between producers */
+	if((fd = open(c->path, O_RDWR | O_NONBLOCK)) < 0)
+		eprint("dzen: error, cannot open '%s': %s\n", c->path, strerror(errno));
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	chan_reset(c, fd);
+}
+
+void
+chan_open_all(void) {
+	int i;
+
+	for(i=0; i < nchannels; i++) {
+		if(channels[i]->issocket)
+			chan_listen(channels[i]);
+		else
+			chan_open_fifo(channels[i]);
+	}
+}
+
+void
+chan_close_all(void) {
+	int i;
+
+	for(i=0; i < nchannels; i++) {
+		if(channels[i]->in.fd != -1)
+			close(channels[i]->in.fd);
+		if(channels[i]->lfd != -1) {
+			close(channels[i]->lfd);
+			unlink(channels[i]->path);
+		}
+	}
+}
+
+/* a new client of a socket channel replaces the previous one */
+void
+chan_accept(Chan *c) {
+	int fd;
+
+	if((fd = accept(c->lfd, NULL, NULL)) < 0)
+		return;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	if(c->in.fd != -1)
+		close(c->in.fd);
+	chan_reset(c, fd);
+}
+
+/* returns 1 if the line of the channel has changed */
+int
+chan_read(Chan *c) {
+	char *l, *last = NULL;
+	ssize_t n;
+
+	n = inbuf_fill(&c->in);
+	if(n < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+
+	while((l = inbuf_line(&c->in)))
+		last = l;
+	if(last)
+		strcpy(c->line, last);
+
+	/* FIFOs are open for writing too, only a socket client can go away */
+	if(n <= 0) {
+		close(c->in.fd);
+		chan_reset(c, -1);
+	}
+
+	return last != NULL;
+}
+
+static void
+compose_append(char *buf, size_t *len, const char *s) {
+	size_t n = strlen(s);
+
+	if(*len + n >= MAX_LINE_LEN) {
+		n = MAX_LINE_LEN - 1 - *len;
+		while(n && ((unsigned char)s[n] & 0xc0) == 0x80)
+			n--;
+	}
+	memcpy(buf + *len, s, n);
+	*len += n;
+	buf[*len] = '\0';
+}
+
+/* the first channel offset after x, -1 if there is none */
+static int
+chan_next(int x) {
+	int i, next = -1;
+
+	for(i=0; i < nchannels; i++)
+		if(channels[i]->x > x && (next == -1 || channels[i]->x < next))
+			next = channels[i]->x;
+	return next;
+}
+
+static void
+compose_region(char *buf, size_t *len, int x, int next, const char *text) {
+	char rg[32];
+
+	snprintf(rg, sizeof rg, "^rg(%d;%d)", x, next == -1 ? -1 : next - x);
+	compose_append(buf, len, rg);
+	compose_append(buf, len, text);
+}
+
+/*
+ * Build the title line from the stdin title and the lines of all
+ * channels. Each of them is drawn in a region of its own, see ^rg():
+ * the stdin title up to the first channel, every channel from its x
+ * offset up to the next one.
+ */
+const char *
+chan_compose(const char *title) {
+	static char buf[MAX_LINE_LEN];
+	size_t len = 0;
+	int i;
+
+	buf[0] = '\0';
+	compose_region(buf, &len, 0, chan_next(-1), title ? title : "");
+	for(i=0; i < nchannels; i++)
+		compose_region(buf, &len, channels[i]->x, chan_next(channels[i]->x),
+				channels[i]->line);
+
+	return buf;
+}
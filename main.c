@@ -17,8 +17,11 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
-#include <sys/select.h>
-#include <sys/time.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 
 #ifndef HOST_NAME_MAX
@@ -27,30 +30,24 @@
 
 Dzen dzen = {0};
 static int last_cnt = 0;
-typedef void sigfunc(int);
 click_a sens_areas[MAX_CLICKABLE_AREAS];
 int sens_areas_cnt=0;
 
 
 static void
 clean_up(void) {
-	int i;
-
+	if(dzen.hist_file)
+		hist_flush();
 	free_event_list();
-#ifndef DZEN_XFT
-	if(dzen.font.set)
-		XFreeFontSet(dzen.dpy, dzen.font.set);
-	else
-		XFreeFont(dzen.dpy, dzen.font.xfont);
-#endif
+	chan_close_all();
+	free_fonts();
 
+	free_surfaces();
+	icon_free_all();
+	ras_free();
 	XFreePixmap(dzen.dpy, dzen.title_win.drawable);
 	if(dzen.slave_win.max_lines) {
-		for(i=0; i < dzen.slave_win.max_lines; i++) {
-			XFreePixmap(dzen.dpy, dzen.slave_win.drawable[i]);
-			XDestroyWindow(dzen.dpy, dzen.slave_win.line[i]);
-		}
-		free(dzen.slave_win.line);
+		XFreePixmap(dzen.dpy, dzen.slave_win.pm);
 		XDestroyWindow(dzen.dpy, dzen.slave_win.win);
 	}
 	XFreeGC(dzen.dpy, dzen.gc);
@@ -60,102 +57,195 @@ clean_up(void) {
 	XCloseDisplay(dzen.dpy);
 }
 
-static void
-catch_sigusr1(int s) {
-	(void)s;
-	do_action(sigusr1);
+static int sig_fd = -1;
+
+/*
+ * Signals with an event attached are blocked and read from a signalfd
+ * in event_loop(), so their actions run like any other action.
+ */
+static int
+setup_signals(void) {
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	if(find_event(onexit) != -1)
+		sigaddset(&mask, SIGTERM);
+	if(find_event(sigusr1) != -1)
+		sigaddset(&mask, SIGUSR1);
+	if(find_event(sigusr2) != -1)
+		sigaddset(&mask, SIGUSR2);
+
+	if(sigprocmask(SIG_BLOCK, &mask, NULL) < 0
+			|| (sig_fd = signalfd(-1, &mask, SFD_CLOEXEC)) < 0)
+		return -1;
+
+	return 0;
 }
 
 static void
-catch_sigusr2(int s) {
-	(void)s;
-	do_action(sigusr2);
+handle_signal(void) {
+	struct signalfd_siginfo si;
+
+	if(read(sig_fd, &si, sizeof si) != sizeof si)
+		return;
+
+	switch(si.ssi_signo) {
+		case SIGTERM:
+			do_action(onexit);
+			break;
+		case SIGUSR1:
+			do_action(sigusr1);
+			break;
+		case SIGUSR2:
+			do_action(sigusr2);
+			break;
+	}
 }
 
-static void
-catch_sigterm(int s) {
-	(void)s;
-	do_action(onexit);
+void
+free_buffer(void) {
+	int i;
+	for(i=dzen.slave_win.hoff; i<dzen.slave_win.tcnt; i++) {
+		dzen.slave_win.tbuf[SLINE(i)] = NULL;
+		dzen.slave_win.tdl[SLINE(i)] = NULL;
+	}
+	arena_clear();
+	if(dzen.hist_file)
+		hist_clear();
+	/* buffer lines are about to be reused */
+	for(i=0; i < dzen.slave_win.max_lines; i++)
+		dzen.slave_win.dline[i] = -1;
+	dzen.slave_win.tcnt =
+		dzen.slave_win.thead =
+		dzen.slave_win.hoff =
+		dzen.slave_win.last_line_vis =
+		last_cnt = 0;
 }
 
-static void
-catch_alrm(int s) {
-	(void)s;
-	do_action(onexit);
-	clean_up();
-	exit(EXIT_SUCCESS);
+/*
+ * Drops the oldest line of the buffer. Line numbers shift down by one,
+ * the view keeps showing the same lines, or the newest ones if it
+ * followed the input. With -history-file the line is only dropped from
+ * memory and is read from the file from then on, unless it could not
+ * be written to the file, see hist_flush().
+ */
+void
+evict_line(void) {
+	SWIN *s = &dzen.slave_win;
+	int i;
+
+	arena_drop();
+	s->tbuf[s->thead] = NULL;
+	s->tdl[s->thead] = NULL;
+	s->thead = (s->thead + 1) % s->tsize;
+	if(dzen.hist_file && hist_has(s->hoff)) {
+		s->hoff++;
+		return;
+	}
+	s->tcnt--;
+
+	for(i=0; i < s->max_lines; i++)
+		if(s->dline[i] != -1)
+			s->dline[i]--;
+	if(s->first_line_vis > 0) {
+		s->first_line_vis--;
+		s->last_line_vis--;
+	}
+	if(last_cnt > 0)
+		last_cnt--;
 }
 
-static sigfunc *
-setup_signal(int signr, sigfunc *shandler) {
-	struct sigaction nh, oh;
+Dlist *
+buf_line(int l, char **text) {
+	SWIN *s = &dzen.slave_win;
 
-	nh.sa_handler = shandler;
-	sigemptyset(&nh.sa_mask);
-	nh.sa_flags = 0;
+	if(l < 0 || l >= s->tcnt)
+		return NULL;
+	if(l < s->hoff)
+		return hist_line(l, text);
+	if(text)
+		*text = s->tbuf[SLINE(l)];
+	return s->tdl[SLINE(l)];
+}
 
-	if(sigaction(signr, &nh, &oh) < 0)
-		return SIG_ERR;
+static char *
+buf_text(int l) {
+	char *text = NULL;
 
-	return NULL;
+	buf_line(l, &text);
+	return text;
 }
 
-char *rem=NULL;
-static int
-chomp(char *inbuf, char *outbuf, int start, int len) {
-	int i=0;
-	int off=start;
-
-	if(rem) {
-		strncpy(outbuf, rem, strlen(rem));
-		i += strlen(rem);
-		free(rem);
-		rem = NULL;
-	}
-	while(off < len) {
-		if(i > MAX_LINE_LEN) {
-			outbuf[i] = '\0';
-			return ++off;
-		}
-		if(inbuf[off] != '\n') {
-			 outbuf[i++] = inbuf[off++];
-		}
-		else if(inbuf[off] == '\n') {
-			outbuf[i] = '\0';
-			return ++off;
-		}
-	}
+static Inbuf stdin_buf = { STDIN_FILENO };
 
-	outbuf[i] = '\0';
-	rem = estrdup(outbuf);
-	return 0;
+/* dispatch every complete line to the title or the slave window */
+static void
+read_lines(void) {
+	char *line;
+
+	/* lines are views into stdin_buf, valid until the next read */
+	title_batch_begin();
+	while((line = inbuf_line(&stdin_buf))) {
+		if(!dzen.slave_win.ishmenu
+				&& dzen.tsupdate
+				&& dzen.slave_win.max_lines
+				&& ((dzen.cur_line == 0) || !(dzen.cur_line % (dzen.slave_win.max_lines+1))))
+			drawheader(line);
+		else if(!dzen.slave_win.ishmenu
+				&& !dzen.tsupdate
+				&& ((dzen.cur_line == 0) || !dzen.slave_win.max_lines))
+			drawheader(line);
+		else
+			drawbody(line);
+		dzen.cur_line++;
+	}
+	title_batch_end();
 }
 
-void
-free_buffer(void) {
-	int i;
-	for(i=0; i<dzen.slave_win.tcnt; i++) {
-		free(dzen.slave_win.tbuf[i]);
-		dzen.slave_win.tbuf[i] = NULL;
+/* draw the frames of -proto binary, with -coalesce only the newest one */
+static void
+read_frames(void) {
+	unsigned char *frame, *last = NULL;
+	size_t len, lastlen = 0;
+
+	while((frame = inbuf_frame(&stdin_buf, &len))) {
+		if(!dzen.coalesce) {
+			drawframe(frame, len);
+			continue;
+		}
+		if(last)
+			dzen.title_win.ncoalesced++;
+		last = frame;
+		lastlen = len;
 	}
-	dzen.slave_win.tcnt =
-		dzen.slave_win.last_line_vis =
-		last_cnt = 0;
+	if(last)
+		drawframe(last, lastlen);
 }
 
 /*
- * Read one line from stdin. If zero bits are read then return -1 if dzen is
- * not persistent, otherwise return -2 if it is persistent.
+ * Read from stdin and dispatch every complete line. If zero bits are read
+ * then return -1 if dzen is not persistent, otherwise return -2 if it is
+ * persistent.
  */
 //TODO (PM) The check for `ispersistent' is outside the logical scope of this
 // function
 static int
 read_stdin(void) {
-	char buf[MAX_LINE_LEN],
-		 retbuf[MAX_LINE_LEN];
-	ssize_t n, n_off=0;
+	ssize_t n;
+
+	n = inbuf_fill(&stdin_buf);
+	if(n < 0) {
+		if(errno == EINTR)
+			return 0;
+		perror("read");	//TODO (PM) Consolidate error handling
+		exit(EXIT_FAILURE);
+	}
+
+	if(dzen.binproto)
+		read_frames();
+	else
+		read_lines();
 
-	n = read(STDIN_FILENO, buf, sizeof buf);
 	if(n == 0) {	// If 0 bits are read
 		if(!dzen.ispersistent) {	// And dzen is not persistent
 			dzen.running = False;	// Stop running
@@ -166,46 +256,124 @@ read_stdin(void) {
 		else
 			return -2;	// Is persistent
 	}
-	else if (n > 0) {
-		while((n_off = chomp(buf, retbuf, n_off, n))) {
-			if(!dzen.slave_win.ishmenu
-					&& dzen.tsupdate
-					&& dzen.slave_win.max_lines
-					&& ((dzen.cur_line == 0) || !(dzen.cur_line % (dzen.slave_win.max_lines+1))))
-				drawheader(retbuf);
-			else if(!dzen.slave_win.ishmenu
-					&& !dzen.tsupdate
-					&& ((dzen.cur_line == 0) || !dzen.slave_win.max_lines))
-				drawheader(retbuf);
-			else
-				drawbody(retbuf);
-			dzen.cur_line++;
-		}
-	}
-	else {
-		perror("read");	//TODO (PM) Consolidate error handling
-		exit(EXIT_FAILURE);
-	}
 	return 0;
 }
 
+static void
+x_put_line(int line) {
+	XRectangle r;
+
+	slot_rect(line, &r);
+	XCopyArea(dzen.dpy, dzen.slave_win.pm, dzen.slave_win.win, dzen.gc,
+			r.x, r.y, r.width, r.height, r.x, r.y);
+}
+
 static void
 x_hilight_line(int line) {
-	drawtext(dzen.slave_win.tbuf[line + dzen.slave_win.first_line_vis], 1, line, dzen.slave_win.alignment);
-	XCopyArea(dzen.dpy, dzen.slave_win.drawable[line], dzen.slave_win.line[line], dzen.gc,
-			0, 0, dzen.slave_win.width, dzen.line_height, 0, 0);
+	drawtext(buf_text(line + dzen.slave_win.first_line_vis), 1, line, dzen.slave_win.alignment);
+	dzen.slave_win.dline[line] = -1;
+	x_put_line(line);
 }
 
 static void
 x_unhilight_line(int line) {
-	drawtext(dzen.slave_win.tbuf[line + dzen.slave_win.first_line_vis], 0, line, dzen.slave_win.alignment);
-	XCopyArea(dzen.dpy, dzen.slave_win.drawable[line], dzen.slave_win.line[line], dzen.rgc,
-			0, 0, dzen.slave_win.width, dzen.line_height, 0, 0);
+	drawtext(buf_text(line + dzen.slave_win.first_line_vis), 0, line, dzen.slave_win.alignment);
+	dzen.slave_win.dline[line] = line + dzen.slave_win.first_line_vis;
+	x_put_line(line);
+}
+
+/* menu line under the pointer, hilighted */
+static int hover = -1;
+
+static int
+slave_line_at(int x, int y) {
+	SWIN *s = &dzen.slave_win;
+	int i = s->ishmenu ? x / s->lw : y / dzen.line_height;
+
+	return i < 0 ? 0 : i >= s->max_lines ? s->max_lines - 1 : i;
+}
+
+static void
+x_hover(int line) {
+	if(line == hover)
+		return;
+	if(hover != -1)
+		x_unhilight_line(hover);
+	if(line != -1)
+		x_hilight_line(line);
+	hover = line;
+}
+
+/*
+ * After scrolling by less than a page the lines still visible are
+ * moved to their new place in the slave pixmap, so only the lines
+ * entering the window have to be drawn.
+ */
+static void
+x_scroll_lines(void) {
+	SWIN *s = &dzen.slave_win;
+	int i, d, n, from, to;
+
+	for(i=0; i < s->max_lines && s->dline[i] == -1; i++)
+		;
+	if(i == s->max_lines)
+		return;
+
+	d = s->first_line_vis - (s->dline[i] - i);
+	if(d == 0 || d >= s->max_lines || -d >= s->max_lines)
+		return;
+
+	n = s->max_lines - abs(d);
+	from = d > 0 ? d : 0;
+	to = d > 0 ? 0 : -d;
+	if(s->ishmenu)
+		XCopyArea(dzen.dpy, s->pm, s->pm, dzen.gc, from * s->lw, 0,
+				n * s->lw, dzen.line_height, to * s->lw, 0);
+	else
+		XCopyArea(dzen.dpy, s->pm, s->pm, dzen.gc, 0, from * dzen.line_height,
+				s->width, n * dzen.line_height, 0, to * dzen.line_height);
+	memmove(&s->dline[to], &s->dline[from], n * sizeof(int));
+	for(i = d > 0 ? n : 0; i < (d > 0 ? s->max_lines : -d); i++)
+		s->dline[i] = -1;
+	/* the hovered slot is drawn hilighted again, and the slot its old
+	 * pixels moved to plain */
+	if(hover != -1)
+		s->dline[hover] = -1;
+	/* the last line of -m h is wider than the one moved there */
+	if(s->ishmenu)
+		s->dline[s->max_lines-1] = -1;
+}
+
+static void
+x_put_all(void) {
+	SWIN *s = &dzen.slave_win;
+
+	if(s->ishmenu)
+		XCopyArea(dzen.dpy, s->pm, s->win, dzen.gc, 0, 0,
+				dzen.title_win.width, dzen.line_height, 0, 0);
+	else
+		XCopyArea(dzen.dpy, s->pm, s->win, dzen.gc, 0, 0,
+				s->width, s->max_lines * dzen.line_height, 0, 0);
+}
+
+static void
+x_render_body(void) {
+	int i, l;
+
+	dzen.slave_win.dirty = False;
+	x_scroll_lines();
+	for(i=0; i < dzen.slave_win.max_lines; i++) {
+		l = i + dzen.slave_win.first_line_vis;
+		if(i < dzen.slave_win.last_line_vis && dzen.slave_win.dline[i] != l) {
+			drawtext(buf_text(l), i == hover, i, dzen.slave_win.alignment);
+			dzen.slave_win.dline[i] = l < dzen.slave_win.tcnt && i != hover ? l : -1;
+		}
+	}
+	x_put_all();
 }
 
 void
 x_draw_body(void) {
-	int i;
 	dzen.x = 0;
 	dzen.y = 0;
 	dzen.w = dzen.slave_win.width;
@@ -222,14 +390,11 @@ x_draw_body(void) {
 		}
 	}
 
-	for(i=0; i < dzen.slave_win.max_lines; i++) {
-		if(i < dzen.slave_win.last_line_vis)
-			drawtext(dzen.slave_win.tbuf[i + dzen.slave_win.first_line_vis],
-					0, i, dzen.slave_win.alignment);
-	}
-	for(i=0; i < dzen.slave_win.max_lines; i++)
-		XCopyArea(dzen.dpy, dzen.slave_win.drawable[i], dzen.slave_win.line[i], dzen.gc,
-				0, 0, dzen.slave_win.width, dzen.line_height, 0, 0);
+	/* with -fps the next frame does the drawing */
+	if(dzen.fps)
+		dzen.slave_win.dirty = True;
+	else
+		x_render_body();
 }
 
 static void
@@ -501,13 +666,15 @@ x_read_resources(void) {
 			dzen.title_win.name  = estrdup(xvalue.addr);
 		if( XrmGetResource(xdb, "dzen2.slavename", "*", datatype, &xvalue) == True )
 			dzen.slave_win.name  = estrdup(xvalue.addr);
+		if( XrmGetResource(xdb, "dzen2.iconcache", "*", datatype, &xvalue) == True )
+			dzen.icon_cache = strtoul(xvalue.addr, NULL, 10) * 1024;
 		XrmDestroyDatabase(xdb);
 	}
 }
 
 static void
 x_create_windows(int use_ewmh_dock) {
-	XSetWindowAttributes wa;
+	XSetWindowAttributes wa, swa;
 	Window root;
 	int i;
 	XRectangle si;
@@ -516,9 +683,9 @@ x_create_windows(int use_ewmh_dock) {
 	root = RootWindow(dzen.dpy, dzen.screen);
 
 	/* style */
-	if((dzen.norm[ColBG] = getcolor(dzen.bg)) == ~0lu)
+	if((dzen.norm[ColBG] = newcolor(dzen.bg)) == ~0lu)
 		eprint("dzen: error, cannot allocate color '%s'\n", dzen.bg);
-	if((dzen.norm[ColFG] = getcolor(dzen.fg)) == ~0lu)
+	if((dzen.norm[ColFG] = newcolor(dzen.fg)) == ~0lu)
 		eprint("dzen: error, cannot allocate color '%s'\n", dzen.fg);
 	setfont(dzen.fnt);
 
@@ -528,6 +695,10 @@ x_create_windows(int use_ewmh_dock) {
 	wa.override_redirect = (use_ewmh_dock ? 0 : 1);
 	wa.background_pixmap = ParentRelative;
 	wa.event_mask = ExposureMask | ButtonReleaseMask | ButtonPressMask | ButtonMotionMask | EnterWindowMask | LeaveWindowMask | KeyPressMask;
+	/* menu lines are found from the pointer position, see x_hover() */
+	swa = wa;
+	if(dzen.slave_win.ismenu)
+		swa.event_mask |= PointerMotionMask;
 
 #ifdef DZEN_XINERAMA
 	queryscreeninfo(dzen.dpy, &si, dzen.xinescreen);
@@ -566,8 +737,9 @@ x_create_windows(int use_ewmh_dock) {
 	if(dzen.slave_win.max_lines) {
 		dzen.slave_win.first_line_vis = 0;
 		dzen.slave_win.last_line_vis  = 0;
-		dzen.slave_win.line     = emalloc(sizeof(Window) * dzen.slave_win.max_lines);
-		dzen.slave_win.drawable =  emalloc(sizeof(Drawable) * dzen.slave_win.max_lines);
+		dzen.slave_win.dline = emalloc(sizeof(int) * dzen.slave_win.max_lines);
+		for(i=0; i < dzen.slave_win.max_lines; i++)
+			dzen.slave_win.dline[i] = -1;
 
 		/* horizontal menu mode */
 		if(dzen.slave_win.ishmenu) {
@@ -583,30 +755,21 @@ x_create_windows(int use_ewmh_dock) {
 					dzen.slave_win.x, dzen.slave_win.y, dzen.slave_win.width, dzen.line_height, 0,
 					DefaultDepth(dzen.dpy, dzen.screen), CopyFromParent,
 					DefaultVisual(dzen.dpy, dzen.screen),
-					CWOverrideRedirect | CWBackPixmap | CWEventMask, &wa);
+					CWOverrideRedirect | CWBackPixmap | CWEventMask, &swa);
 			XStoreName(dzen.dpy, dzen.slave_win.win, dzen.slave_win.name);
 
-			for(i=0; i < dzen.slave_win.max_lines; i++) {
-				dzen.slave_win.drawable[i] = XCreatePixmap(dzen.dpy, root, ew+r,
-						dzen.line_height, DefaultDepth(dzen.dpy, dzen.screen));
-			XFillRectangle(dzen.dpy, dzen.slave_win.drawable[i], dzen.rgc, 0, 0,
-					ew+r, dzen.line_height);
-			}
-
-
-			/* windows holding the lines */
-			for(i=0; i < dzen.slave_win.max_lines; i++)
-				dzen.slave_win.line[i] = XCreateWindow(dzen.dpy, dzen.slave_win.win,
-						i*ew, 0, (i == dzen.slave_win.max_lines-1) ? ew+r : ew, dzen.line_height, 0,
-						DefaultDepth(dzen.dpy, dzen.screen), CopyFromParent,
-						DefaultVisual(dzen.dpy, dzen.screen),
-						CWOverrideRedirect | CWBackPixmap | CWEventMask, &wa);
+			/* the lines side by side */
+			dzen.slave_win.pm = XCreatePixmap(dzen.dpy, root, dzen.slave_win.width,
+					dzen.line_height, DefaultDepth(dzen.dpy, dzen.screen));
+			XFillRectangle(dzen.dpy, dzen.slave_win.pm, dzen.rgc, 0, 0,
+					dzen.slave_win.width, dzen.line_height);
 
 			/* As we don't use the title window in this mode,
 			 * we reuse its width value
 			 */
 			dzen.title_win.width = dzen.slave_win.width;
 			dzen.slave_win.width = ew+r;
+			dzen.slave_win.lw = ew;
 		}
 
 		/* vertical slave window */
@@ -621,23 +784,15 @@ x_create_windows(int use_ewmh_dock) {
 					dzen.slave_win.x, dzen.slave_win.y, dzen.slave_win.width, dzen.slave_win.max_lines * dzen.line_height, 0,
 					DefaultDepth(dzen.dpy, dzen.screen), CopyFromParent,
 					DefaultVisual(dzen.dpy, dzen.screen),
-					CWOverrideRedirect | CWBackPixmap | CWEventMask, &wa);
+					CWOverrideRedirect | CWBackPixmap | CWEventMask, &swa);
 			XStoreName(dzen.dpy, dzen.slave_win.win, dzen.slave_win.name);
 
-			for(i=0; i < dzen.slave_win.max_lines; i++) {
-				dzen.slave_win.drawable[i] = XCreatePixmap(dzen.dpy, root, dzen.slave_win.width,
-						dzen.line_height, DefaultDepth(dzen.dpy, dzen.screen));
-				XFillRectangle(dzen.dpy, dzen.slave_win.drawable[i], dzen.rgc, 0, 0,
-						dzen.slave_win.width, dzen.line_height);
-			}
-
-			/* windows holding the lines */
-			for(i=0; i < dzen.slave_win.max_lines; i++)
-				dzen.slave_win.line[i] = XCreateWindow(dzen.dpy, dzen.slave_win.win,
-						0, i*dzen.line_height, dzen.slave_win.width, dzen.line_height, 0,
-						DefaultDepth(dzen.dpy, dzen.screen), CopyFromParent,
-						DefaultVisual(dzen.dpy, dzen.screen),
-						CWOverrideRedirect | CWBackPixmap | CWEventMask, &wa);
+			/* the lines one below the other */
+			dzen.slave_win.pm = XCreatePixmap(dzen.dpy, root, dzen.slave_win.width,
+					dzen.slave_win.max_lines * dzen.line_height, DefaultDepth(dzen.dpy, dzen.screen));
+			XFillRectangle(dzen.dpy, dzen.slave_win.pm, dzen.rgc, 0, 0,
+					dzen.slave_win.width, dzen.slave_win.max_lines * dzen.line_height);
+			dzen.slave_win.lw = dzen.slave_win.width;
 		}
 	}
 
@@ -651,23 +806,11 @@ x_map_window(Window win) {
 
 static void
 x_redraw(Window w) {
-	int i;
-
 	if(!dzen.slave_win.ishmenu
 			&& w == dzen.title_win.win)
 		drawheader(NULL);
-	if(!dzen.tsupdate && w == dzen.slave_win.win) {
-		for(i=0; i < dzen.slave_win.max_lines; i++)
-			XCopyArea(dzen.dpy, dzen.slave_win.drawable[i], dzen.slave_win.line[i], dzen.gc,
-					0, 0, dzen.slave_win.width, dzen.line_height, 0, 0);
-	}
-	else {
-		for(i=0; i < dzen.slave_win.max_lines; i++)
-			if(w == dzen.slave_win.line[i]) {
-				XCopyArea(dzen.dpy, dzen.slave_win.drawable[i], dzen.slave_win.line[i], dzen.gc,
-						0, 0, dzen.slave_win.width, dzen.line_height, 0, 0);
-			}
-	}
+	if(dzen.slave_win.max_lines && w == dzen.slave_win.win)
+		x_put_all();
 }
 
 static void
@@ -684,23 +827,24 @@ handle_xev(void) {
 				x_redraw(ev.xexpose.window);
 			break;
 		case EnterNotify:
-			if(dzen.slave_win.ismenu) {
-				for(i=0; i < dzen.slave_win.max_lines; i++)
-					if(ev.xcrossing.window == dzen.slave_win.line[i])
-						x_hilight_line(i);
-			}
+			if(dzen.slave_win.ismenu
+					&& ev.xcrossing.window == dzen.slave_win.win)
+				x_hover(slave_line_at(ev.xcrossing.x, ev.xcrossing.y));
 			if(!dzen.slave_win.ishmenu
 					&& ev.xcrossing.window == dzen.title_win.win)
 				do_action(entertitle);
 			if(ev.xcrossing.window == dzen.slave_win.win)
 				do_action(enterslave);
 			break;
+		case MotionNotify:
+			if(dzen.slave_win.ismenu
+					&& ev.xmotion.window == dzen.slave_win.win)
+				x_hover(slave_line_at(ev.xmotion.x, ev.xmotion.y));
+			break;
 		case LeaveNotify:
-			if(dzen.slave_win.ismenu) {
-				for(i=0; i < dzen.slave_win.max_lines; i++)
-					if(ev.xcrossing.window == dzen.slave_win.line[i])
-						x_unhilight_line(i);
-			}
+			if(dzen.slave_win.ismenu
+					&& ev.xcrossing.window == dzen.slave_win.win)
+				x_hover(-1);
 			if(!dzen.slave_win.ishmenu
 					&& ev.xcrossing.window == dzen.title_win.win)
 				do_action(leavetitle);
@@ -709,11 +853,9 @@ handle_xev(void) {
 			}
 			break;
 		case ButtonRelease:
-			if(dzen.slave_win.ismenu) {
-				for(i=0; i < dzen.slave_win.max_lines; i++)
-					if(ev.xbutton.window == dzen.slave_win.line[i])
-						dzen.slave_win.sel_line = i;
-			}
+			if(dzen.slave_win.ismenu
+					&& ev.xbutton.window == dzen.slave_win.win)
+				dzen.slave_win.sel_line = slave_line_at(ev.xbutton.x, ev.xbutton.y);
 
 			/* clickable areas */
              for(i=sens_areas_cnt; i>=0; i--) {
@@ -759,6 +901,9 @@ handle_xev(void) {
 			XLookupString(&ev.xkey, buf, sizeof buf, &ksym, 0);
 			do_action(ksym+keymarker);
 			break;
+		default:
+			ras_event(&ev);
+			break;
 
 		/* TODO: XRandR rotation and size  */
 	}
@@ -768,6 +913,8 @@ static void
 handle_newl(void) {
 	XWindowAttributes wa;
 
+	if(dzen.hist_file)
+		hist_flush();
 
 	if(dzen.slave_win.max_lines && (dzen.slave_win.tcnt > last_cnt)) {
 		do_action(onnewinput);
@@ -796,87 +943,179 @@ handle_newl(void) {
 	}
 }
 
+static struct timespec last_frame;
+static int frame_fd = -1;
+
+static void
+commit_frame(void) {
+	title_commit();
+	if(dzen.slave_win.dirty) {
+		dzen.w = dzen.slave_win.width;
+		dzen.h = dzen.line_height;
+		x_render_body();
+	}
+	XFlush(dzen.dpy);
+}
+
+/*
+ * Frame scheduler for -fps: input and actions only mark the windows
+ * dirty, this renders them at most dzen.fps times per second. If the
+ * next frame is not due yet the frame timer is armed for it.
+ */
+static void
+schedule_frame(void) {
+	struct timespec now;
+	struct itimerspec its;
+	long wait;
+
+	if(!dzen.fps || !(dzen.title_win.dirty || dzen.slave_win.dirty))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	wait = 1000000 / dzen.fps
+		- ((now.tv_sec - last_frame.tv_sec) * 1000000
+		+ (now.tv_nsec - last_frame.tv_nsec) / 1000);
+	if(wait <= 0) {
+		commit_frame();
+		last_frame = now;
+		return;
+	}
+
+	memset(&its, 0, sizeof its);
+	its.it_value.tv_sec  = wait / 1000000;
+	its.it_value.tv_nsec = (wait % 1000000) * 1000;
+	timerfd_settime(frame_fd, 0, &its, NULL);
+}
+
+static int
+watch_fd(int epfd, int fd) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* closed channel fds drop out of the epoll set by themselves */
+static void
+handle_chan_fd(int epfd, int fd) {
+	Chan *c;
+	int i;
+
+	for(i=0; i < nchannels; i++) {
+		c = channels[i];
+		if(fd == c->in.fd) {
+			if(chan_read(c))
+				title_refresh();
+		}
+		else if(fd == c->lfd) {
+			chan_accept(c);
+			if(c->in.fd != -1)
+				watch_fd(epfd, c->in.fd);
+		}
+		else
+			continue;
+		break;
+	}
+}
+
+static int
+handle_stdin(int epfd, int tmo_fd) {
+	struct itimerspec its;
+	int dr;
+
+	if((dr = read_stdin()) == -1)
+		return -1;
+	handle_newl();
+
+	if(dr == -2) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+		if(dzen.timeout > 0) {
+			/* exit after the timeout */
+			memset(&its, 0, sizeof its);
+			its.it_value.tv_sec = dzen.timeout;
+			timerfd_settime(tmo_fd, 0, &its, NULL);
+		}
+	}
+	return dr;
+}
+
 static void
 event_loop(void) {
-	int xfd, nbits, dr=0;
-	fd_set rmask;
+	struct epoll_event evs[16];
+	uint64_t expirations;
+	int epfd, xfd, tmo_fd=-1, icon_fd, i, n, dr=0;
 
 	// Assign connection number for the specified display
 	xfd = ConnectionNumber(dzen.dpy);
-	while(dzen.running) {
-		FD_ZERO(&rmask);	// Clear newly declared set
-		FD_SET(xfd, &rmask);	// Assign the fd to a set
-		if(dr != -2)	//TODO (PM) Won't this statement always return true?
-			FD_SET(STDIN_FILENO, &rmask);
-			//TODO (PM) This would make a second call to the same function.
-			// Can more than one fd be assigned to a set?
 
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0
+			|| (frame_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0
+			|| (tmo_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) < 0)
+		eprint("dzen: error, cannot set up event loop: %s\n", strerror(errno));
+
+	watch_fd(epfd, xfd);
+	watch_fd(epfd, frame_fd);
+	watch_fd(epfd, tmo_fd);
+	if(sig_fd != -1)
+		watch_fd(epfd, sig_fd);
+	/* icons are read by a worker from now on */
+	if((icon_fd = icon_async_start()) != -1)
+		watch_fd(epfd, icon_fd);
+	for(i=0; i < nchannels; i++) {
+		if(channels[i]->lfd != -1)
+			watch_fd(epfd, channels[i]->lfd);
+		if(channels[i]->in.fd != -1)
+			watch_fd(epfd, channels[i]->in.fd);
+	}
+
+	/* regular files can not be polled, but never block either */
+	if(watch_fd(epfd, STDIN_FILENO) < 0)
+		while((dr = handle_stdin(epfd, tmo_fd)) == 0)
+			;
+
+	while(dzen.running) {
 		while(XPending(dzen.dpy))
 			handle_xev();
+		schedule_frame();
+		if(!dzen.running)
+			break;
 
-		nbits = select(xfd+1, &rmask, NULL, NULL, NULL);
-		if (nbits != -1) {
-			//TODO (PM) Again, dr has only been assigned the value, zero
-			if (dr != -2 && FD_ISSET(STDIN_FILENO, &rmask)) {
-				if ((dr = read_stdin()) == -1)
-					return;
-				handle_newl();
-			}
-			if (dr == -2 && dzen.timeout > 0) {
-				/* set an alarm to kill us after the timeout */
-				struct itimerval t;
-				memset(&t, 0, sizeof t);
-				t.it_value.tv_sec = dzen.timeout;
-				t.it_value.tv_usec = 0;
-				setitimer(ITIMER_REAL, &t, NULL);
-			}
-			if (FD_ISSET(xfd, &rmask))
-				handle_xev();
-		}
-		else {
-			perror("select");	//TODO (PM) Consolidate error handling
+		if((n = epoll_wait(epfd, evs, sizeof evs / sizeof evs[0], -1)) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("epoll_wait");	//TODO (PM) Consolidate error handling
 			exit(EXIT_FAILURE);
 		}
-	}
-	return;
-}
 
-static void
-x_preload(const char *fontstr, int p) {
-	char *def, **missing;
-	int i, n;
-
-	missing = NULL;
-
-	dzen.fnpl[p].set = XCreateFontSet(dzen.dpy, fontstr, &missing, &n, &def);
-	if(missing)
-		XFreeStringList(missing);
-
-	if(dzen.fnpl[p].set) {
-		XFontSetExtents *font_extents;
-		XFontStruct **xfonts;
-		char **font_names;
-		dzen.fnpl[p].ascent = dzen.fnpl[p].descent = 0;
-		font_extents = XExtentsOfFontSet(dzen.fnpl[p].set);
-		n = XFontsOfFontSet(dzen.fnpl[p].set, &xfonts, &font_names);
-		for(i = 0, dzen.fnpl[p].ascent = 0, dzen.fnpl[p].descent = 0; i < n; i++) {
-			if(dzen.fnpl[p].ascent < (*xfonts)->ascent)
-				dzen.fnpl[p].ascent = (*xfonts)->ascent;
-			if(dzen.fnpl[p].descent < (*xfonts)->descent)
-				dzen.fnpl[p].descent = (*xfonts)->descent;
-			xfonts++;
+		for(i=0; i < n && dzen.running; i++) {
+			int fd = evs[i].data.fd;
+
+			if(fd == xfd)
+				;	/* read by XPending() above */
+			else if(fd == STDIN_FILENO) {
+				if((dr = handle_stdin(epfd, tmo_fd)) == -1)
+					break;
+			}
+			else if(fd == sig_fd)
+				handle_signal();
+			else if(fd == frame_fd)
+				read(frame_fd, &expirations, sizeof expirations);
+			else if(fd == tmo_fd)
+				dzen.running = False;
+			else if(fd == icon_fd)
+				icon_async_done();
+			else
+				handle_chan_fd(epfd, fd);
 		}
+		if(dr == -1)
+			break;
 	}
-	else {
-		if(dzen.fnpl[p].xfont)
-			XFreeFont(dzen.dpy, dzen.fnpl[p].xfont);
-		dzen.fnpl[p].xfont = NULL;
-		if(!(dzen.fnpl[p].xfont = XLoadQueryFont(dzen.dpy, fontstr)))
-			eprint("dzen: error, cannot load font: '%s'\n", fontstr);
-		dzen.fnpl[p].ascent = dzen.fnpl[p].xfont->ascent;
-		dzen.fnpl[p].descent = dzen.fnpl[p].xfont->descent;
-	}
-	dzen.fnpl[p].height = dzen.fnpl[p].ascent + dzen.fnpl[p].descent;
+
+	close(tmo_fd);
+	close(frame_fd);
+	close(epfd);
 }
 
 static void
@@ -884,14 +1123,14 @@ font_preload(char *s) {
 	int k = 0;
 	char *buf = strtok(s,",");
 	while( buf != NULL ) {
-		if(k<64)
-			x_preload(buf, k++);
+		if(k < MAX_PRELOAD_FONTS)
+			dzen.fnpl[k++] = buf;
 		buf = strtok(NULL,",");
 	}
 }
 
-static int use_ewmh_dock = 0;
-static char *action_string, *fnpre = NULL;
+int use_ewmh_dock = 0;
+char *action_string, *fnpre = NULL;
 
 static void set_dzen()
 /*
@@ -916,20 +1155,35 @@ static void set_dzen()
 	dzen.tsupdate = 0;
 	dzen.line_height = 0;
 	dzen.title_win.expand = noexpand;
+	dzen.icon_cache = ICON_CACHE_KB * 1024;
 }
 
 int main( int ac, char *av[] )
 {
-	int i;
-
 	set_dzen();	// Default values
 	x_connect();
 	x_read_resources();
-	parse_opts(ac, av);
+	parse_opts(ac, av, &dzen);
 
 	if(dzen.tsupdate && !dzen.slave_win.max_lines)
 		dzen.tsupdate = False;
 
+	/* channel offsets must not move with the width of the line */
+	if(nchannels)
+		dzen.title_win.alignment = ALIGNLEFT;
+
+	/* the history so far stays on disk, see history.c */
+	if(dzen.hist_file && dzen.slave_win.max_lines) {
+		if((dzen.slave_win.tcnt = hist_open(dzen.hist_file)) == -1) {
+			fprintf(stderr, "dzen: cannot use the history file, history is not kept\n");
+			dzen.slave_win.tcnt = 0;
+			dzen.hist_file = NULL;
+		}
+		dzen.slave_win.hoff = last_cnt = dzen.slave_win.tcnt;
+	}
+	else
+		dzen.hist_file = NULL;
+
 	if(!dzen.title_win.width)
 		dzen.title_win.width = dzen.slave_win.width;
 
@@ -962,33 +1216,24 @@ int main( int ac, char *av[] )
 		}
 	}
 
-	if((find_event(onexit) != -1)
-			&& (setup_signal(SIGTERM, catch_sigterm) == SIG_ERR))
-		fprintf(stderr, "dzen: error hooking SIGTERM\n");
-
-	if((find_event(sigusr1) != -1)
-			&& (setup_signal(SIGUSR1, catch_sigusr1) == SIG_ERR))
-		fprintf(stderr, "dzen: error hooking SIGUSR1\n");
-
-	if((find_event(sigusr2) != -1)
-		&& (setup_signal(SIGUSR2, catch_sigusr2) == SIG_ERR))
-		fprintf(stderr, "dzen: error hooking SIGUSR2\n");
-
-	if(setup_signal(SIGALRM, catch_alrm) == SIG_ERR)
-		fprintf(stderr, "dzen: error hooking SIGALARM\n");
+	if(setup_signals() < 0)
+		fprintf(stderr, "dzen: error hooking signals\n");
 
 	x_create_windows(use_ewmh_dock);
 
 	if(!dzen.slave_win.ishmenu)
 		x_map_window(dzen.title_win.win);
-	else {
+	else
 		XMapRaised(dzen.dpy, dzen.slave_win.win);
-		for(i=0; i < dzen.slave_win.max_lines; i++)
-			XMapWindow(dzen.dpy, dzen.slave_win.line[i]);
-	}
 
 	if( fnpre != NULL )
 		font_preload(fnpre);
+	if(dzen.icon_pre)
+		icon_preload(dzen.icon_pre);
+	if(dzen.slave_win.tcnt)
+		x_draw_body();
+
+	chan_open_all();
 
 	do_action(onstart);
 
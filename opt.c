@@ -6,8 +6,11 @@
  */
 
 #include "dzen.h"
+#include "opt.h"
 
+#include <stdio.h>	// printf, fprintf
 #include <stdlib.h>	// strtol, exit
+#include <string.h>	// strncmp
 #include <errno.h>	// errno
 
 static int strtoi( char *string )	//TODO Further customize for context
@@ -37,14 +40,34 @@ static int strtoi( char *string )	//TODO Further customize for context
 static void set_lines( Dzen *dzen, char *arg )
 {
 	dzen->slave_win.max_lines = strtoi(arg);
-	if (dzen->slave_win.max_lines) {
+}
+
+static void set_history( Dzen *dzen, char *arg )
+{
+	dzen->slave_win.tsize = strtoi(arg);
+}
+
+static void set_history_file( Dzen *dzen, char *arg )
+{
+	dzen->hist_file = arg;
+}
+
+/* the buffer is sized once -l and -history are both known */
+static void alloc_buffer( Dzen *dzen )
+{
+	if (!dzen->slave_win.max_lines)
+		return;
+	if (!dzen->slave_win.tsize) {
 		if(MIN_BUF_SIZE % dzen->slave_win.max_lines)
 			dzen->slave_win.tsize = MIN_BUF_SIZE + (dzen->slave_win.max_lines - (MIN_BUF_SIZE % dzen->slave_win.max_lines));
 		else
 			dzen->slave_win.tsize = MIN_BUF_SIZE;
-
-		dzen->slave_win.tbuf = emalloc(dzen->slave_win.tsize * sizeof(char *));
 	}
+	else if (dzen->slave_win.tsize < dzen->slave_win.max_lines)
+		dzen->slave_win.tsize = dzen->slave_win.max_lines;
+
+	dzen->slave_win.tbuf = emalloc(dzen->slave_win.tsize * sizeof(char *));
+	dzen->slave_win.tdl = emalloc(dzen->slave_win.tsize * sizeof(Dlist *));
 }
 
 static void set_geometry( Dzen *dzen, char *arg )
@@ -73,6 +96,56 @@ static void set_update( Dzen *dzen, char *arg )
 	dzen->tsupdate = True;
 }
 
+static void set_coalesce( Dzen *dzen, char *arg )
+{
+	dzen->coalesce = True;
+}
+
+static void set_fps( Dzen *dzen, char *arg )
+{
+	dzen->fps = strtoi(arg);
+	if (dzen->fps < 0)
+		dzen->fps = 0;
+}
+
+static void set_chan( Dzen *dzen, char *arg )
+{
+	chan_add(arg);
+}
+
+static void set_proto( Dzen *dzen, char *arg )
+/*
+ * Select the input protocol, 't'ext (default) or 'b'inary frames
+ */
+{
+	if (arg[0] == 'b')
+		dzen->binproto = True;
+	else if (arg[0] == 't')
+		dzen->binproto = False;
+	else
+		eprint("Invalid input\n");
+}
+
+static void set_raster( Dzen *dzen, char *arg )
+{
+	dzen->raster = True;
+}
+
+static void set_icon_cache( Dzen *dzen, char *arg )
+/*
+ * Size of the icon cache in kB
+ */
+{
+	int kb = strtoi(arg);
+
+	dzen->icon_cache = kb > 0 ? kb * 1024UL : 0;
+}
+
+static void set_icon_preload( Dzen *dzen, char *arg )
+{
+	dzen->icon_pre = arg;
+}
+
 static void set_expand( Dzen *dzen, char *arg )
 {
 	switch (arg[0]) {
@@ -206,10 +279,12 @@ static void set_font_preload( Dzen *dzen, char *arg )
 	fnpre = estrdup(arg);
 }
 
+#ifdef DZEN_XINERAMA
 static void set_xin_screen( Dzen *dzen, char *arg )
 {
 	dzen->xinescreen = strtoi(arg);
 }
+#endif
 
 //TODO The static int use_ewmh_dock is initialized to 0 in main.c and then
 // called within the main function
@@ -222,7 +297,7 @@ static void print_version( Dzen *dzen, char *arg )
 {
 	printf("dzen-"VERSION", (C)opyright 2007-2009 Robert Manea\n");
 	printf("Enabled optional features:"
-#ifdef DZEN_XMP
+#ifdef DZEN_XPM
 		" XPM"
 #endif
 #ifdef DZEN_XFT
@@ -230,6 +305,12 @@ static void print_version( Dzen *dzen, char *arg )
 #endif
 #ifdef DZEN_XINERAMA
 		" XINERAMA"
+#endif
+#ifdef DZEN_XSHM
+		" XSHM"
+#endif
+#ifdef DZEN_XRENDER
+		" XRENDER"
 #endif
 		"\n");
 	exit(EXIT_SUCCESS);
@@ -245,26 +326,35 @@ struct option
 	{ "-l", 2, 1, set_lines },
 	{ "-geometry", 9, 1, set_geometry },
 	{ "-u", 2, 0, set_update },
+	{ "-coalesce", 10, 0, set_coalesce },
+	{ "-chan", 6, 1, set_chan },
 	{ "-expand", 7, 1, set_expand },
+	{ "-proto", 7, 1, set_proto },
+	{ "-raster", 8, 0, set_raster },
+	{ "-icon-cache", 12, 1, set_icon_cache },
+	{ "-icon-preload", 14, 1, set_icon_preload },
 	{ "-p", 2, 2, set_persist },
 	{ "-ta", 3, 1, set_title_align },
 	{ "-sa", 4, 1, set_slave_align },
 	{ "-m", 2, 2, set_menu },
+	{ "-fn-preload", 11, 1, set_font_preload },
 	{ "-fn", 3, 1, set_font },
 	{ "-e", 2, 1, set_event },
 	{ "-title-name", 11, 1, set_title_name },
 	{ "-slave-name", 11, 1, set_slave_name },
 	{ "-bg", 3, 1, set_bg },
+	{ "-fps", 5, 1, set_fps },
 	{ "-fg", 2, 1, set_fg },
 	{ "-y", 2, 1, set_y },
+#ifdef DZEN_XINERAMA
+	{ "-xs", 4, 1, set_xin_screen },
+#endif
 	{ "-x", 2, 1, set_x },
 	{ "-w", 2, 1, set_width },
+	{ "-history-file", 14, 1, set_history_file },
+	{ "-history", 9, 1, set_history },
 	{ "-h", 2, 1, set_height },
 	{ "-tw", 3, 1, set_title_width },
-	{ "-fn-preload", 11, 1, set_font_preload },
-#ifdef DZEN_XINERAMA
-	{ "-xs", 4, 1, set_xin_screen },
-#endif
 	{ "-dock", 6, 0, set_dock },
 	{ "-v", 3, 0, print_version },
 	{ NULL, 0, 0, NULL }
@@ -293,13 +383,12 @@ void parse_opts( int ac, char **av, Dzen *dzen )
 				}
 				else if (opts[j].has_arg == 0) {	// Not required argument
 					opts[j].setter(dzen, NULL);
-					i++;
 					/* Unnecessary argument satisfies the
 					 * `setter' function declaration in the
 					 * `option' structure declaration */
 				}
 				else if (opts[j].has_arg == 2) {	// Optional argument
-					if (i + 1 > ac)	// Last option, no argument
+					if (i + 1 >= ac)	// Last option, no argument
 						opts[j].setter(dzen, NULL);
 					else if (av[i + 1][0] == '-')	// Followed by option
 						opts[j].setter(dzen, NULL);
@@ -311,6 +400,6 @@ void parse_opts( int ac, char **av, Dzen *dzen )
 		}
 	}
 
-	
+	alloc_buffer(dzen);
 }
 
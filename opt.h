@@ -4,3 +4,7 @@
 
 void parse_opts( int, char **, Dzen * );
 
+/* set by parse_opts(), defined in main.c */
+extern int use_ewmh_dock;
+extern char *action_string, *fnpre;
+
@@ -0,0 +1,278 @@
+/*
+ * (C)opyright 2007-2009 Robert Manea <rob dot manea at gmail dot com>
+ * See LICENSE file for license details.
+ *
+ */
+
+#include "dzen.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef DZEN_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
+
+/*
+ * Client-side rasterizer for -raster.
+ *
+ * Rectangles, arcs and bitmaps of a line are drawn into an image in
+ * memory instead of sending a request for each of them. The image is
+ * uploaded with a single request, through MIT-SHM if dzen was built
+ * with DZEN_XSHM and the server supports it, with XPutImage otherwise.
+ *
+ * Pixels are chosen the way X does for most cases, arcs may differ
+ * from the server by a pixel at the edge.
+ */
+
+static XImage *img = NULL;
+static Bool use_shm = False;
+#ifdef DZEN_XSHM
+static XShmSegmentInfo shminfo;
+static Bool put_pending = False;
+static int shm_error;
+#endif
+
+#ifdef DZEN_XSHM
+static int
+shm_errhandler(Display *dpy, XErrorEvent *ev) {
+	shm_error = 1;
+	return 0;
+}
+
+static Bool
+is_completion(Display *dpy, XEvent *ev, XPointer arg) {
+	return ev->type == XShmGetEventBase(dpy) + ShmCompletion;
+}
+
+/* a remote or restricted server may refuse to attach the segment */
+static XImage *
+shm_image(int w, int h) {
+	int (*oldhandler)(Display *, XErrorEvent *);
+	XImage *im;
+
+	if(!XShmQueryExtension(dzen.dpy))
+		return NULL;
+	im = XShmCreateImage(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen),
+			DefaultDepth(dzen.dpy, dzen.screen), ZPixmap, NULL, &shminfo, w, h);
+	if(!im)
+		return NULL;
+
+	shminfo.shmid = shmget(IPC_PRIVATE, im->bytes_per_line * im->height, IPC_CREAT | 0600);
+	if(shminfo.shmid == -1) {
+		XDestroyImage(im);
+		return NULL;
+	}
+	shminfo.shmaddr = im->data = shmat(shminfo.shmid, NULL, 0);
+	shminfo.readOnly = True;
+	shm_error = 0;
+	if(shminfo.shmaddr != (char *)-1) {
+		XSync(dzen.dpy, False);
+		oldhandler = XSetErrorHandler(shm_errhandler);
+		XShmAttach(dzen.dpy, &shminfo);
+		XSync(dzen.dpy, False);
+		XSetErrorHandler(oldhandler);
+	}
+	/* the segment goes away with the last detach */
+	shmctl(shminfo.shmid, IPC_RMID, NULL);
+
+	if(shminfo.shmaddr == (char *)-1 || shm_error) {
+		if(shminfo.shmaddr != (char *)-1)
+			shmdt(shminfo.shmaddr);
+		im->data = NULL;
+		XDestroyImage(im);
+		return NULL;
+	}
+	return im;
+}
+#endif
+
+void
+ras_free(void) {
+	if(!img)
+		return;
+#ifdef DZEN_XSHM
+	if(use_shm) {
+		XShmDetach(dzen.dpy, &shminfo);
+		XSync(dzen.dpy, False);
+		shmdt(shminfo.shmaddr);
+		img->data = NULL;
+		put_pending = False;
+	}
+#endif
+	XDestroyImage(img);
+	img = NULL;
+	use_shm = False;
+}
+
+/* the server may still be reading the image of the last upload */
+static void
+wait_put(void) {
+#ifdef DZEN_XSHM
+	XEvent ev;
+
+	if(put_pending) {
+		XIfEvent(dzen.dpy, &ev, is_completion, NULL);
+		put_pending = False;
+	}
+#endif
+}
+
+/*
+ * Prepares an image of at least w x h for the next line, returns False
+ * if there is none. The title and the slave window share the image.
+ */
+Bool
+ras_begin(int w, int h) {
+	wait_put();
+	if(img && img->width >= w && img->height == h)
+		return True;
+
+	ras_free();
+#ifdef DZEN_XSHM
+	if((img = shm_image(w, h))) {
+		use_shm = True;
+		return True;
+	}
+#endif
+	img = XCreateImage(dzen.dpy, DefaultVisual(dzen.dpy, dzen.screen),
+			DefaultDepth(dzen.dpy, dzen.screen), ZPixmap, 0, NULL, w, h, 32, 0);
+	if(!img)
+		return False;
+	img->data = emalloc(img->bytes_per_line * h);
+	return True;
+}
+
+/* called for every X event, to notice finished uploads */
+void
+ras_event(XEvent *ev) {
+#ifdef DZEN_XSHM
+	if(use_shm && is_completion(dzen.dpy, ev, NULL))
+		put_pending = False;
+#endif
+}
+
+static void
+span(int y, int x0, int x1, unsigned long pixel) {
+	unsigned int *p;
+
+	if(y < 0 || y >= img->height)
+		return;
+	wait_put();
+	x0 = x0 < 0 ? 0 : x0;
+	x1 = x1 > img->width ? img->width : x1;
+
+	if(img->bits_per_pixel == 32) {
+		p = (unsigned int *)(img->data + y * img->bytes_per_line) + x0;
+		for(; x0 < x1; x0++)
+			*p++ = pixel;
+	}
+	else
+		for(; x0 < x1; x0++)
+			XPutPixel(img, x0, y, pixel);
+}
+
+/* like XFillRectangle() */
+void
+ras_fill(int x, int y, int w, int h, unsigned long pixel) {
+	int i;
+
+	for(i=0; i < h; i++)
+		span(y+i, x, x+w, pixel);
+}
+
+/* like XDrawRectangle(), the outline covers w+1 x h+1 pixels */
+void
+ras_rect(int x, int y, int w, int h, unsigned long pixel) {
+	span(y, x, x+w+1, pixel);
+	span(y+h, x, x+w+1, pixel);
+	ras_fill(x, y+1, 1, h-1, pixel);
+	ras_fill(x+w, y+1, 1, h-1, pixel);
+}
+
+/* angle of (x, y) in degrees, 0 to 360 counterclockwise, within 0.25 degrees */
+static double
+angle(double x, double y) {
+	double ax = x < 0 ? -x : x, ay = y < 0 ? -y : y, z, a;
+
+	if(ax == 0 && ay == 0)
+		return 0;
+	z = ax > ay ? ay/ax : ax/ay;
+	a = (45.0 + 15.64 * (1 - z)) * z;
+	if(ay > ax)
+		a = 90 - a;
+	if(x < 0)
+		a = 180 - a;
+	if(y < 0)
+		a = 360 - a;
+	return a;
+}
+
+/*
+ * Like XFillArc() in ArcPieSlice mode or XDrawArc() with a d x d
+ * bounding box. Angles are in 1/64 degrees as for X.
+ */
+void
+ras_arc(int x, int y, int d, int a1, int a2, int fill, unsigned long pixel) {
+	double r = d / 2.0, dx, dy, dd, a, start, ext;
+	int i, j;
+
+	if(d <= 0)
+		return;
+	start = a1 / 64.0;
+	ext = a2 / 64.0;
+	if(ext < 0) {
+		start += ext;
+		ext = -ext;
+	}
+	while(start < 0)
+		start += 360;
+
+	for(j=0; j < d; j++) {
+		dy = r - (j + 0.5);
+		for(i=0; i < d; i++) {
+			dx = (i + 0.5) - r;
+			dd = dx*dx + dy*dy;
+			if(dd > r*r || (!fill && dd <= (r-1)*(r-1)))
+				continue;
+			if(ext < 360) {
+				a = angle(dx, dy) - start;
+				while(a < 0)
+					a += 360;
+				if(a > ext)
+					continue;
+			}
+			span(y+j, x+i, x+i+1, pixel);
+		}
+	}
+}
+
+/* like XCopyPlane() of an XBM bitmap as read by XReadBitmapFileData() */
+void
+ras_bitmap(int x, int y, int w, int h, const unsigned char *data,
+		unsigned long fg, unsigned long bg) {
+	int i, j, bpl = (w + 7) / 8;
+
+	for(j=0; j < h; j++)
+		for(i=0; i < w; i++)
+			span(y+j, x+i, x+i+1,
+					data[j*bpl + i/8] & (1 << (i%8)) ? fg : bg);
+}
+
+/* uploads the columns x0 to x1 of the image to the same place in d */
+void
+ras_put(Drawable d, GC gc, int x0, int x1) {
+	x0 = x0 < 0 ? 0 : x0;
+	x1 = x1 > img->width ? img->width : x1;
+	if(x0 >= x1)
+		return;
+#ifdef DZEN_XSHM
+	if(use_shm) {
+		XShmPutImage(dzen.dpy, d, gc, img, x0, 0, x0, 0, x1 - x0, img->height, True);
+		put_pending = True;
+		return;
+	}
+#endif
+	XPutImage(dzen.dpy, d, gc, img, x0, 0, x0, 0, x1 - x0, img->height);
+}
@@ -6,6 +6,7 @@
  */
 
 #include "dzen.h"
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,15 @@ emalloc(unsigned int size) {
 	return res;
 }
 
+void *
+erealloc(void *ptr, unsigned int size) {
+	void *res = realloc(ptr, size);
+
+	if(!res)
+		eprint("fatal: could not realloc() %u bytes\n", size);
+	return res;
+}
+
 void
 eprint(const char *errstr, ...) {
 	va_list ap;
@@ -42,6 +52,18 @@ estrdup(const char *str) {
 		eprint("fatal: could not malloc() %u bytes\n", strlen(str));
 	return res;
 }
+/* FNV-1a, start with HASH_INIT or the result of a previous call */
+unsigned long
+hashmem(const void *data, size_t len, unsigned long h) {
+	const unsigned char *p = data;
+
+	while(len--) {
+		h ^= *p++;
+		h *= 16777619UL;
+	}
+	return h;
+}
+
 void
 spawn(const char *arg) {
 	static const char *shell = NULL;
@@ -54,6 +76,11 @@ spawn(const char *arg) {
 	* clean from stupid signal handlers. */
 	if(fork() == 0) {
 		if(fork() == 0) {
+			sigset_t mask;
+
+			/* do not pass on the signals blocked for the event loop */
+			sigemptyset(&mask);
+			sigprocmask(SIG_SETMASK, &mask, NULL);
 			setsid();
 			execl(shell, shell, "-c", arg, (char *)NULL);
 			fprintf(stderr, "dzen: execl '%s -c %s'", shell, arg);